@@ -101,3 +101,7 @@ void* alist_remove(AList* list, size_t index) {
     list->size--;
     return e;
 }
+
+void alist_sort(AList* list, int (*compare)(const void*, const void*)) {
+    qsort(list->elements, list->size, sizeof(void*), compare);
+}
@@ -95,4 +95,8 @@ void alist_set(AList* list, size_t index, void* item);
 /// Removes an item at an index
 void* alist_remove(AList* list, size_t index);
 
+/// Sorts the elements of the `alist` in place. As with `qsort(3)`,
+/// `compare` is passed pointers to the elements being compared.
+void alist_sort(AList* list, int (*compare)(const void*, const void*));
+
 #endif // __DEDUP_ALIST_H__
@@ -0,0 +1,284 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+// apply_bench measures how quickly each replacement strategy in clone.c
+// replaces a file with a duplicate, independently of scanning.
+//
+// For each mode, `pairs` pairs of identical files are written to a new
+// directory under the target directory. Each pair is then replaced the same
+// way `deduplicate` does it, including the clone id check that follows a
+// clone. End to end latency and the latency of each step (choosing a staging
+// name, cloning or linking, copying metadata, renaming or unlinking, and
+// verifying) are reported from the `--stats` instrumentation.
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../clone.h"
+#include "../stats.h"
+#include "../utils.h"
+
+typedef enum ApplyMode {
+    APPLY_CLONE,
+    APPLY_LINK,
+    APPLY_SYMLINK,
+    APPLY_MODE_COUNT,
+} ApplyMode;
+
+static const char* const MODE_NAMES[APPLY_MODE_COUNT] = {
+    [APPLY_CLONE] = "clone",
+    [APPLY_LINK] = "link",
+    [APPLY_SYMLINK] = "symlink",
+};
+
+static const StatsStage STEPS[] = {
+    STATS_APPLY,
+    STATS_APPLY_STAGE,
+    STATS_APPLY_CLONE,
+    STATS_APPLY_METADATA,
+    STATS_APPLY_RENAME,
+    STATS_APPLY_VERIFY,
+};
+
+static uint64_t mix(uint64_t z) {
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void write_file(const char* path, const uint8_t* content, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        err(1, "%s", path);
+    }
+    if (write(fd, content, size) != (ssize_t) size) {
+        err(1, "%s", path);
+    }
+    close(fd);
+}
+
+static void pair_path(char* out, const char* dir, char side, size_t i) {
+    snprintf(out, PATH_MAX, "%s/%c%zu", dir, side, i);
+}
+
+static void create_pairs(const char* dir, size_t pairs, size_t size) {
+    uint8_t* content = malloc(size);
+    char path[PATH_MAX];
+    for (size_t i = 0; i < pairs; i++) {
+        for (size_t b = 0; b < size; b += 8) {
+            uint64_t block = mix(i << 32 | b / 8);
+            memcpy(content + b, &block, size - b < 8 ? size - b : 8);
+        }
+        pair_path(path, dir, 'a', i);
+        write_file(path, content, size);
+        pair_path(path, dir, 'b', i);
+        write_file(path, content, size);
+    }
+    free(content);
+}
+
+static void remove_pairs(const char* dir, size_t pairs) {
+    char path[PATH_MAX];
+    for (size_t i = 0; i < pairs; i++) {
+        pair_path(path, dir, 'a', i);
+        unlink(path);
+        pair_path(path, dir, 'b', i);
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+// replaces `dst` with `src` the way `deduplicate` does
+static int apply(ApplyMode mode, const char* src, const char* dst, bool preserve_parent_mtime) {
+    StatsSpan span = stats_begin(STATS_APPLY);
+    int result = 0;
+    switch (mode) {
+    case APPLY_CLONE: {
+        uint64_t origin_clone_id = get_clone_id(src);
+        result = replace_with_clone(src, dst, preserve_parent_mtime);
+        if (!result) {
+            StatsSpan verify = stats_begin(STATS_APPLY_VERIFY);
+            result = origin_clone_id != get_clone_id(dst);
+            stats_end(&verify);
+        }
+        break;
+    }
+    case APPLY_LINK:
+        result = replace_with_link(src, dst);
+        break;
+    case APPLY_SYMLINK:
+        result = replace_with_symlink(src, dst);
+        break;
+    case APPLY_MODE_COUNT:
+        break;
+    }
+    stats_end(&span);
+    return result;
+}
+
+// percentiles are the upper bound of a histogram bucket, which may be
+// larger than anything that was actually seen
+static uint64_t percentile(const StageStats* s, double p) {
+    uint64_t bound = stats_percentile(s, p);
+    return bound < s->max_ns ? bound : s->max_ns;
+}
+
+static void report(ApplyMode mode, size_t pairs, size_t failed, uint64_t elapsed) {
+    for (size_t i = 0; i < sizeof(STEPS) / sizeof(STEPS[0]); i++) {
+        StageStats s;
+        stats_collect(STEPS[i], &s);
+        if (s.count == 0) {
+            continue;
+        }
+        printf("%-8s %-16s %8llu %10.1f %10.1f %10.1f %10.1f\n",
+               MODE_NAMES[mode],
+               stats_stage_name(STEPS[i]),
+               (unsigned long long) s.count,
+               s.wall_ns / 1e3 / s.count,
+               percentile(&s, 0.50) / 1e3,
+               percentile(&s, 0.99) / 1e3,
+               s.max_ns / 1e3);
+    }
+    printf("%-8s %zu replaced in %.3f ms, %.0f/s, %zu failed\n",
+           MODE_NAMES[mode],
+           pairs - failed,
+           elapsed / 1e6,
+           (pairs - failed) / (elapsed / 1e9),
+           failed);
+}
+
+static void usage(const char* pgm) {
+    fprintf(stderr,
+            "usage: %s [-n pairs] [-s size] [-m mode] [-kp] [dir]\n\n"
+                "Options:\n"
+                "  -n pairs  Number of duplicate pairs per mode. Default: 1000\n"
+                "  -s size   Size of each file in bytes. Default: 65536\n"
+                "  -m mode   clone, link, or symlink. May be repeated. Default: all\n"
+                "  -k        Keep the generated files.\n"
+                "  -p        Preserve parent mtimes, like dedup -m.\n",
+            pgm);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    size_t pairs = 1000;
+    size_t size = 65536;
+    bool modes[APPLY_MODE_COUNT] = { 0 };
+    bool any_mode = false;
+    bool keep = false;
+    bool preserve_parent_mtime = false;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "n:s:m:kp")) != -1) {
+        switch (ch) {
+        case 'n':
+            pairs = strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            size = strtoull(optarg, NULL, 10);
+            break;
+        case 'm': {
+            ApplyMode m = 0;
+            while (m < APPLY_MODE_COUNT && strcmp(optarg, MODE_NAMES[m])) {
+                m++;
+            }
+            if (m == APPLY_MODE_COUNT) {
+                usage(argv[0]);
+            }
+            modes[m] = any_mode = true;
+            break;
+        }
+        case 'k':
+            keep = true;
+            break;
+        case 'p':
+            preserve_parent_mtime = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (pairs == 0 || size == 0 || argc > 1) {
+        usage(argv[0]);
+    }
+    const char* target = argc ? argv[0] : ".";
+
+    stats_enable();
+
+    printf("%-8s %-16s %8s %10s %10s %10s %10s\n",
+           "mode", "step", "count", "mean_us", "p50_us", "p99_us", "max_us");
+    for (ApplyMode mode = 0; mode < APPLY_MODE_COUNT; mode++) {
+        if (any_mode && !modes[mode]) {
+            continue;
+        }
+
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s/apply-bench.XXXXXX", target);
+        if (!mkdtemp(dir)) {
+            err(1, "%s", dir);
+        }
+        create_pairs(dir, pairs, size);
+
+        // the files were just written, so make sure the benchmark is not
+        // measuring writeback
+        sync();
+        stats_reset();
+
+        char src[PATH_MAX], dst[PATH_MAX];
+        size_t failed = 0;
+        uint64_t started = stats_now();
+        for (size_t i = 0; i < pairs; i++) {
+            pair_path(src, dir, 'a', i);
+            pair_path(dst, dir, 'b', i);
+            if (apply(mode, src, dst, preserve_parent_mtime)) {
+                failed++;
+            }
+        }
+        uint64_t elapsed = stats_now() - started;
+
+        report(mode, pairs, failed, elapsed);
+
+        if (keep) {
+            fprintf(stderr, "kept %s\n", dir);
+        } else {
+            remove_pairs(dir, pairs);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+#!/bin/sh
+# Copyright © 2026 TTKB, LLC.
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Runs `dedup` against generated trees at several thread counts and appends
+# files/s, MB/s, peak RSS, and syscall counts to a tab separated results file.
+#
+# Environment:
+#
+#   DEDUP        dedup binary (default: ../dedup)
+#   BENCH_DIR    where trees are generated (default: $TMPDIR/dedup-bench)
+#   RESULTS      results file (default: results.tsv)
+#   THREADS      thread counts to run (default: "1 2 4 8")
+#   RUNS         runs of each workload and thread count (default: 3)
+#   WORKLOADS    workloads to run (default: all)
+#   DEDUP_FLAGS  flags passed to dedup (default: -n -l -P)
+#   TIME         time(1) command reporting peak RSS (default: /usr/bin/time -l
+#                on macOS, /usr/bin/time -v elsewhere)
+#
+# `-n -l` is used so the trees are left untouched between runs and can live
+# on any filesystem, including ones that do not support clones.
+
+set -eu
+
+DEDUP=${DEDUP:-../dedup}
+GENTREE=${GENTREE:-./gentree}
+BENCH_DIR=${BENCH_DIR:-${TMPDIR:-/tmp}/dedup-bench}
+RESULTS=${RESULTS:-results.tsv}
+THREADS=${THREADS:-"1 2 4 8"}
+RUNS=${RUNS:-3}
+DEDUP_FLAGS=${DEDUP_FLAGS:--n -l -P}
+
+# name and gentree arguments of each workload
+workload_args() {
+    case "$1" in
+    small)   echo "-n 20000 -s log:512:256k -d 30 -l 2 -c 5" ;;
+    large)   echo "-n 200 -s 1m:16m -d 50" ;;
+    collide) echo "-n 5000 -s 64k -d 0 -c 90" ;;
+    deep)    echo "-n 5000 -s 4k:16k -D 64 -W 1" ;;
+    wide)    echo "-n 20000 -s 1k:4k -D 0" ;;
+    # the workloads used by perfcheck.sh. scan is almost entirely unique
+    # sizes, group is almost entirely same-size files.
+    scan)    echo "-n 20000 -s 1k:1m -d 0" ;;
+    group)   echo "-n 20000 -s 8k -d 50 -c 40 -D 3 -W 8" ;;
+    *)       echo "unknown workload: $1" >&2; exit 1 ;;
+    esac
+}
+WORKLOADS=${WORKLOADS:-"small large collide deep wide scan group"}
+
+case "$(uname)" in
+Darwin)
+    TIME=${TIME:-/usr/bin/time -l}
+    peak_rss_kb() { awk '/maximum resident set size/ { print int($1 / 1024) }' "$1"; }
+    ;;
+*)
+    TIME=${TIME:-/usr/bin/time -v}
+    peak_rss_kb() { awk -F: '/Maximum resident set size/ { print $2 + 0 }' "$1"; }
+    ;;
+esac
+
+# trees are only regenerated when their arguments change
+generate() {
+    tree="$BENCH_DIR/$1"
+    args="$(workload_args "$1")"
+    if [ -f "$tree.summary" ] && [ "$(sed 1q "$tree.summary")" = "args $args" ]; then
+        return
+    fi
+    rm -rf "$tree" "$tree.summary"
+    mkdir -p "$tree"
+    echo "generating $1: $args" >&2
+    # shellcheck disable=SC2086
+    { echo "args $args"; "$GENTREE" $args "$tree"; } > "$tree.summary.tmp"
+    mv "$tree.summary.tmp" "$tree.summary"
+}
+
+summary() {
+    awk -v key="$1" '$1 == key { print $2 }' "$BENCH_DIR/$2.summary"
+}
+
+commit="$(git rev-parse --short HEAD 2>/dev/null || echo unknown)"
+log="$(mktemp)"
+trap 'rm -f "$log"' EXIT
+
+if [ ! -s "$RESULTS" ]; then
+    printf 'commit\tworkload\tthreads\trun\tfiles\tbytes\telapsed_ms\tfiles_per_s\tmb_per_s\tpeak_rss_kb\tsyscalls\n' > "$RESULTS"
+fi
+
+for workload in $WORKLOADS; do
+    generate "$workload"
+    files="$(summary files "$workload")"
+    bytes="$(summary bytes "$workload")"
+
+    for threads in $THREADS; do
+        run=1
+        while [ "$run" -le "$RUNS" ]; do
+            # shellcheck disable=SC2086
+            $TIME "$DEDUP" $DEDUP_FLAGS -t "$threads" --stats "$BENCH_DIR/$workload" \
+                > /dev/null 2> "$log"
+
+            elapsed="$(awk '/^elapsed:/ { print $2 }' "$log")"
+            syscalls="$(awk '/^\tsyscalls:/ { for (i = 3; i <= NF; i += 2) n += $i } END { print n + 0 }' "$log")"
+            rss="$(peak_rss_kb "$log")"
+
+            awk -v commit="$commit" -v workload="$workload" -v threads="$threads" \
+                -v run="$run" -v files="$files" -v bytes="$bytes" \
+                -v elapsed="$elapsed" -v rss="$rss" -v syscalls="$syscalls" \
+                'BEGIN {
+                    s = elapsed / 1000
+                    printf "%s\t%s\t%d\t%d\t%d\t%d\t%.3f\t%.1f\t%.1f\t%d\t%d\n",
+                        commit, workload, threads, run, files, bytes, elapsed,
+                        files / s, bytes / s / 1e6, rss, syscalls
+                }' | tee -a "$RESULTS"
+            run=$((run + 1))
+        done
+    done
+done
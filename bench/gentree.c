@@ -0,0 +1,377 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+// gentree builds a reproducible tree of files for benchmarking `dedup`.
+//
+// The same options and seed always produce the same tree. File contents are
+// generated from a per-content seed in 8 byte blocks, so any byte of any file
+// can be computed without generating the bytes before it.
+
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BUFFER_SIZE (64 * 1024)
+
+typedef enum Distribution {
+    DISTRIBUTION_UNIFORM,
+    DISTRIBUTION_LOG,
+} Distribution;
+
+typedef struct Options {
+    size_t files;
+    Distribution distribution;
+    uint64_t min_size;
+    uint64_t max_size;
+    unsigned duplicates;
+    unsigned links;
+    unsigned collisions;
+    unsigned depth;
+    unsigned width;
+    uint64_t seed;
+} Options;
+
+// a file with content that was not copied from another file
+typedef struct Unique {
+    char* path;
+    uint64_t size;
+    uint64_t content;
+    // when not zero, the first and last bytes are taken from this content
+    uint64_t ends;
+} Unique;
+
+typedef struct Summary {
+    size_t files;
+    size_t directories;
+    size_t duplicates;
+    size_t links;
+    size_t collisions;
+    uint64_t bytes;
+} Summary;
+
+static uint64_t splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t content_block(uint64_t content, uint64_t block) {
+    uint64_t state = content * 0x100000001b3ULL + block;
+    return splitmix64(&state);
+}
+
+static uint8_t content_byte(uint64_t content, uint64_t offset) {
+    return content_block(content, offset / 8) >> (8 * (offset % 8));
+}
+
+static uint64_t random_below(uint64_t* rng, uint64_t n) {
+    return n ? splitmix64(rng) % n : 0;
+}
+
+static bool chance(uint64_t* rng, unsigned percent) {
+    return random_below(rng, 100) < percent;
+}
+
+static uint64_t random_size(uint64_t* rng, const Options* o) {
+    if (o->max_size <= o->min_size) {
+        return o->min_size;
+    }
+
+    if (o->distribution == DISTRIBUTION_LOG) {
+        // many small files and a few large ones
+        double lo = log((double) (o->min_size ?: 1)),
+               hi = log((double) o->max_size),
+               u = (splitmix64(rng) >> 11) * 0x1.0p-53;
+        return exp(lo + (hi - lo) * u);
+    }
+
+    return o->min_size + random_below(rng, o->max_size - o->min_size + 1);
+}
+
+static int parse_size(const char* s, uint64_t* out) {
+    char* end = NULL;
+    errno = 0;
+    uint64_t size = strtoull(s, &end, 10);
+    if (errno || end == s) {
+        return -1;
+    }
+
+    switch (*end) {
+    case 'g': case 'G': size <<= 10; [[fallthrough]];
+    case 'm': case 'M': size <<= 10; [[fallthrough]];
+    case 'k': case 'K': size <<= 10; end++; break;
+    case '\0': case ':': break;
+    default: return -1;
+    }
+
+    *out = size;
+    return *end == '\0' || *end == ':' ? (int) (end - s) : -1;
+}
+
+// parses `[log:]min[:max]`
+static int parse_distribution(const char* s, Options* o) {
+    o->distribution = DISTRIBUTION_UNIFORM;
+    if (strncmp(s, "log:", 4) == 0) {
+        o->distribution = DISTRIBUTION_LOG;
+        s += 4;
+    } else if (strncmp(s, "uniform:", 8) == 0) {
+        s += 8;
+    }
+
+    int n = parse_size(s, &o->min_size);
+    if (n < 0) {
+        return -1;
+    }
+    o->max_size = o->min_size;
+    if (s[n] == ':' && parse_size(s + n + 1, &o->max_size) < 0) {
+        return -1;
+    }
+    return o->max_size < o->min_size ? -1 : 0;
+}
+
+static unsigned parse_percent(const char* s) {
+    char* end = NULL;
+    unsigned long p = strtoul(s, &end, 10);
+    if (*end || p > 100) {
+        errx(1, "invalid percentage: %s", s);
+    }
+    return p;
+}
+
+// directories form a `width`-ary tree `depth` levels deep and are numbered
+// breadth first, with 0 being the root.
+static size_t directory_count(const Options* o) {
+    size_t count = 1,
+           level = 1;
+    for (unsigned d = 0; d < o->depth && count < o->files; d++) {
+        level *= o->width;
+        count += level;
+    }
+    return count < o->files ? count : (o->files ?: 1);
+}
+
+static void directory_path(const char* root, size_t n, unsigned width, char* out, size_t size) {
+    if (n == 0) {
+        snprintf(out, size, "%s", root);
+        return;
+    }
+    directory_path(root, (n - 1) / width, width, out, size);
+    size_t len = strlen(out);
+    snprintf(out + len, size - len, "/d%zu", (n - 1) % width);
+}
+
+static void write_file(const char* path, const Unique* u) {
+    static uint8_t buffer[BUFFER_SIZE];
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        err(1, "%s", path);
+    }
+
+    for (uint64_t offset = 0; offset < u->size; offset += BUFFER_SIZE) {
+        size_t length = u->size - offset < BUFFER_SIZE ? u->size - offset : BUFFER_SIZE;
+        for (size_t i = 0; i < length; i += 8) {
+            uint64_t block = content_block(u->content, (offset + i) / 8);
+            memcpy(buffer + i, &block, length - i < 8 ? length - i : 8);
+        }
+        if (offset == 0 && u->ends) {
+            buffer[0] = content_byte(u->ends, 0);
+        }
+        if (offset + length == u->size && u->ends) {
+            buffer[length - 1] = content_byte(u->ends, u->size - 1);
+        }
+        if (write(fd, buffer, length) != (ssize_t) length) {
+            err(1, "%s", path);
+        }
+    }
+
+    close(fd);
+}
+
+static void generate(const char* root, const Options* o, Summary* s) {
+    uint64_t rng = o->seed;
+    char path[PATH_MAX];
+
+    s->directories = directory_count(o);
+    for (size_t d = 0; d < s->directories; d++) {
+        directory_path(root, d, o->width, path, sizeof(path));
+        if (mkdir(path, 0755) && errno != EEXIST) {
+            err(1, "%s", path);
+        }
+    }
+
+    Unique* uniques = calloc(o->files, sizeof(Unique));
+    size_t unique_count = 0;
+
+    for (size_t i = 0; i < o->files; i++) {
+        directory_path(root, i % s->directories, o->width, path, sizeof(path));
+        size_t len = strlen(path);
+        snprintf(path + len, sizeof(path) - len, "/f%zu", i);
+
+        if (unique_count && chance(&rng, o->links)) {
+            Unique* target = &uniques[random_below(&rng, unique_count)];
+            if (link(target->path, path)) {
+                err(1, "%s", path);
+            }
+            s->links++;
+            s->files++;
+            continue;
+        }
+
+        Unique u = {
+            .size = random_size(&rng, o),
+            .content = o->seed ^ splitmix64(&rng),
+        };
+
+        if (unique_count && chance(&rng, o->duplicates)) {
+            Unique* original = &uniques[random_below(&rng, unique_count)];
+            u.size = original->size;
+            u.content = original->content;
+            u.ends = original->ends;
+            s->duplicates++;
+        } else if (unique_count && chance(&rng, o->collisions)) {
+            // same size, first, and last byte, different content
+            Unique* original = &uniques[random_below(&rng, unique_count)];
+            if (original->size >= 16) {
+                u.size = original->size;
+                u.ends = original->ends ?: original->content;
+                s->collisions++;
+            }
+        }
+
+        write_file(path, &u);
+        s->files++;
+        s->bytes += u.size;
+
+        u.path = strdup(path);
+        uniques[unique_count++] = u;
+    }
+
+    for (size_t i = 0; i < unique_count; i++) {
+        free(uniques[i].path);
+    }
+    free(uniques);
+}
+
+__attribute__((noreturn))
+static void usage(const char* pgm) {
+    fprintf(stderr,
+            "usage: %s [-n files] [-s [log:]min[:max]] [-d percent] [-l percent]\n"
+                "       [-c percent] [-D depth] [-W width] [-S seed] directory\n\n"
+                "Options:\n"
+                "  -n files      Number of files to create. Default: 1000\n"
+                "  -s sizes      File size or range of sizes, with an optional k, m, or g\n"
+                "                suffix. Sizes are uniformly distributed unless prefixed\n"
+                "                with log:. Default: 4k:64k\n"
+                "  -d percent    Files that duplicate an earlier file. Default: 25\n"
+                "  -l percent    Files that are hardlinks to an earlier file. Default: 0\n"
+                "  -c percent    Files with the same size, first, and last byte as an\n"
+                "                earlier file, but different content. Default: 0\n"
+                "  -D depth      Depth of the directory tree. Default: 2\n"
+                "  -W width      Subdirectories per directory. Default: 16\n"
+                "  -S seed       Random seed. Default: 1\n",
+            pgm);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    Options o = {
+        .files = 1000,
+        .min_size = 4 * 1024,
+        .max_size = 64 * 1024,
+        .duplicates = 25,
+        .depth = 2,
+        .width = 16,
+        .seed = 1,
+    };
+
+    int ch;
+    while ((ch = getopt(argc, argv, "n:s:d:l:c:D:W:S:")) != -1) {
+        switch (ch) {
+        case 'n':
+            o.files = strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            if (parse_distribution(optarg, &o)) {
+                errx(1, "invalid size: %s", optarg);
+            }
+            break;
+        case 'd':
+            o.duplicates = parse_percent(optarg);
+            break;
+        case 'l':
+            o.links = parse_percent(optarg);
+            break;
+        case 'c':
+            o.collisions = parse_percent(optarg);
+            break;
+        case 'D':
+            o.depth = strtoul(optarg, NULL, 10);
+            break;
+        case 'W':
+            o.width = strtoul(optarg, NULL, 10) ?: 1;
+            break;
+        case 'S':
+            o.seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+    }
+
+    Summary s = { 0 };
+    generate(argv[optind], &o, &s);
+
+    printf("files %zu\n"
+           "bytes %llu\n"
+           "directories %zu\n"
+           "duplicates %zu\n"
+           "links %zu\n"
+           "collisions %zu\n",
+           s.files,
+           (unsigned long long) s.bytes,
+           s.directories,
+           s.duplicates,
+           s.links,
+           s.collisions);
+
+    return 0;
+}
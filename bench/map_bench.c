@@ -0,0 +1,385 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+// map_bench measures the containers in map.c in isolation.
+//
+// Synthetic `FileMetadata` is generated in batches outside of the timed
+// region. Digests are pre-populated, so `visited_tree_insert` never reads a
+// file. For each container and entry count it reports the time per
+// operation, the heap allocations per operation, the heap bytes per entry,
+// and, where `perf_event_open(2)` is available, last level cache misses per
+// operation.
+
+#include <sys/rbtree.h>
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <malloc.h>
+#endif
+
+#include "../map.h"
+
+#define BATCH 65536
+#define PATH_SIZE 32
+
+typedef struct HeapUsage {
+    uint64_t allocations;
+    uint64_t bytes;
+} HeapUsage;
+
+#if defined(__APPLE__)
+
+// the default zone only reports what is in use, so the benchmarks are
+// structured to never free inside of a measured region.
+static void heap_usage(HeapUsage* h) {
+    malloc_statistics_t s;
+    malloc_zone_statistics(NULL, &s);
+    h->allocations = s.blocks_in_use;
+    h->bytes = s.size_in_use;
+}
+
+#elif defined(__GLIBC__)
+
+// glibc allows malloc to be interposed and routes its own allocations (like
+// the one in strdup(3)) through the interposed functions.
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+static uint64_t allocations = 0;
+static int64_t live_bytes = 0;
+
+void* malloc(size_t size) {
+    void* p = __libc_malloc(size);
+    allocations++;
+    live_bytes += malloc_usable_size(p);
+    return p;
+}
+
+void* calloc(size_t count, size_t size) {
+    void* p = __libc_calloc(count, size);
+    allocations++;
+    live_bytes += malloc_usable_size(p);
+    return p;
+}
+
+void* realloc(void* ptr, size_t size) {
+    live_bytes -= malloc_usable_size(ptr);
+    void* p = __libc_realloc(ptr, size);
+    allocations++;
+    live_bytes += malloc_usable_size(p);
+    return p;
+}
+
+void free(void* ptr) {
+    live_bytes -= malloc_usable_size(ptr);
+    __libc_free(ptr);
+}
+
+static void heap_usage(HeapUsage* h) {
+    h->allocations = allocations;
+    h->bytes = live_bytes;
+}
+
+#else
+
+static void heap_usage(HeapUsage* h) {
+    *h = (HeapUsage) { 0 };
+}
+
+#endif
+
+#if defined(__linux__)
+
+static int cache_misses_fd = -1;
+
+static void cache_misses_open() {
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HARDWARE,
+        .size = sizeof(attr),
+        .config = PERF_COUNT_HW_CACHE_MISSES,
+        .disabled = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    cache_misses_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void cache_misses_start() {
+    if (cache_misses_fd >= 0) {
+        ioctl(cache_misses_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static void cache_misses_stop() {
+    if (cache_misses_fd >= 0) {
+        ioctl(cache_misses_fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+}
+
+// returns -1 if the counter is not available
+static int64_t cache_misses_read() {
+    uint64_t count = 0;
+    if (cache_misses_fd < 0 || read(cache_misses_fd, &count, sizeof(count)) != sizeof(count)) {
+        return -1;
+    }
+    ioctl(cache_misses_fd, PERF_EVENT_IOC_RESET, 0);
+    return count;
+}
+
+#else
+
+static void cache_misses_open() {}
+static void cache_misses_start() {}
+static void cache_misses_stop() {}
+static int64_t cache_misses_read() { return -1; }
+
+#endif
+
+typedef struct Batch {
+    FileMetadata entries[BATCH];
+    char paths[BATCH][PATH_SIZE];
+} Batch;
+
+typedef struct Benchmark {
+    const char* name;
+    void* (*setup)(size_t entries);
+    void (*run)(void* state, FileMetadata* entries, size_t count);
+    void (*teardown)(void* state);
+} Benchmark;
+
+static uint64_t splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+// entry `i` of a stream of `total` entries. About a tenth of the entries
+// duplicate an earlier one, and sizes are drawn from a range small enough
+// that most size nodes are shared.
+static void generate_entry(FileMetadata* fm, char* path, size_t i, size_t total) {
+    uint64_t rng = i;
+    uint64_t r = splitmix64(&rng);
+    uint64_t content = r % 10 == 0 && i ? splitmix64(&rng) % i : i;
+
+    uint64_t digest = content;
+    uint64_t block = splitmix64(&digest);
+
+    snprintf(path, PATH_SIZE, "d%llu/f%zu", (unsigned long long) (r % 1024), i);
+    *fm = (FileMetadata) {
+        .device = 1 + r % 2,
+        .inode = i + 1,
+        .nlink = 1,
+        .clone_id = content % (total / 2 + 1),
+        .size = 1 + block % (total / 4 + 1),
+        .path = path,
+        .first = block >> 8,
+        .last = block >> 16,
+    };
+    for (size_t b = 0; b < sizeof(fm->sha256); b += sizeof(block)) {
+        memcpy(fm->sha256 + b, &block, sizeof(block));
+        block = splitmix64(&digest);
+    }
+}
+
+static void* visited_setup(size_t entries) {
+    return new_visited_tree();
+}
+
+static void visited_run(void* tree, FileMetadata* entries, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        visited_tree_insert(tree, &entries[i], NULL);
+    }
+}
+
+static void* duplicate_setup(size_t entries) {
+    return new_duplicate_tree();
+}
+
+static void duplicate_run(void* tree, FileMetadata* entries, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        duplicate_tree_find(tree, &entries[i]);
+    }
+}
+
+static void* clone_id_setup(size_t entries) {
+    return new_clone_id_counts();
+}
+
+static void clone_id_run(void* tree, FileMetadata* entries, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        clone_id_tree_increment(tree, &entries[i]);
+    }
+}
+
+typedef struct DupState {
+    FileMetadata** copies;
+    size_t count;
+} DupState;
+
+static void* dup_setup(size_t entries) {
+    DupState* s = calloc(1, sizeof(DupState));
+    s->copies = calloc(entries, sizeof(FileMetadata*));
+    return s;
+}
+
+// copies are freed in teardown so that only allocations are measured
+static void dup_run(void* state, FileMetadata* entries, size_t count) {
+    DupState* s = state;
+    for (size_t i = 0; i < count; i++) {
+        s->copies[s->count++] = metadata_dup(&entries[i]);
+    }
+}
+
+static void dup_teardown(void* state) {
+    DupState* s = state;
+    for (size_t i = 0; i < s->count; i++) {
+        free_metadata(s->copies[i]);
+    }
+    free(s->copies);
+    free(s);
+}
+
+static const Benchmark BENCHMARKS[] = {
+    { "visited_tree_insert", visited_setup, visited_run, (void (*)(void*)) free_visited_tree },
+    { "duplicate_tree_find", duplicate_setup, duplicate_run, (void (*)(void*)) free_duplicate_tree },
+    { "clone_id_tree_increment", clone_id_setup, clone_id_run, (void (*)(void*)) free_clone_id_counts },
+    { "metadata_dup", dup_setup, dup_run, dup_teardown },
+};
+
+static void run_benchmark(const Benchmark* b, size_t entries, Batch* batch) {
+    void* state = b->setup(entries);
+
+    HeapUsage before, after;
+    heap_usage(&before);
+
+    uint64_t elapsed = 0;
+    int64_t misses = 0;
+    for (size_t offset = 0; offset < entries; offset += BATCH) {
+        size_t count = entries - offset < BATCH ? entries - offset : BATCH;
+        for (size_t i = 0; i < count; i++) {
+            generate_entry(&batch->entries[i], batch->paths[i], offset + i, entries);
+        }
+
+        cache_misses_start();
+        uint64_t started = now_ns();
+        b->run(state, batch->entries, count);
+        elapsed += now_ns() - started;
+        cache_misses_stop();
+
+        int64_t m = cache_misses_read();
+        misses = m < 0 || misses < 0 ? -1 : misses + m;
+    }
+
+    heap_usage(&after);
+    b->teardown(state);
+
+    printf("%-24s %10zu %10.1f %10.2f %12.1f",
+           b->name,
+           entries,
+           (double) elapsed / entries,
+           (double) (after.allocations - before.allocations) / entries,
+           (double) (int64_t) (after.bytes - before.bytes) / entries);
+    if (misses < 0) {
+        printf(" %12s\n", "-");
+    } else {
+        printf(" %12.2f\n", (double) misses / entries);
+    }
+    fflush(stdout);
+}
+
+__attribute__((noreturn))
+static void usage(const char* pgm) {
+    fprintf(stderr,
+            "usage: %s [-m max] [-b benchmark]\n\n"
+                "Options:\n"
+                "  -m max        Run with 10^4 through 10^max entries. Default: 6\n"
+                "  -b benchmark  Only run the named benchmark.\n",
+            pgm);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    unsigned max = 6;
+    const char* only = NULL;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "m:b:")) != -1) {
+        switch (ch) {
+        case 'm':
+            max = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            only = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    Batch* batch = malloc(sizeof(Batch));
+    if (!batch) {
+        err(1, "malloc");
+    }
+
+    cache_misses_open();
+
+    printf("%-24s %10s %10s %10s %12s %12s\n",
+           "benchmark", "entries", "ns/op", "allocs/op", "bytes/entry", "misses/op");
+    for (size_t b = 0; b < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); b++) {
+        if (only && strcmp(only, BENCHMARKS[b].name)) {
+            continue;
+        }
+        size_t entries = 10000;
+        for (unsigned e = 4; e <= max; e++, entries *= 10) {
+            run_benchmark(&BENCHMARKS[b], entries, batch);
+        }
+    }
+
+    free(batch);
+    return 0;
+}
@@ -0,0 +1,99 @@
+#!/bin/sh
+# Copyright © 2026 TTKB, LLC.
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Runs the workloads listed in the baseline with bench.sh and compares the
+# median of each metric against the baseline. Exits non-zero if any metric
+# is worse than the baseline by more than its tolerance, or if no baseline
+# has been recorded.
+#
+# Environment:
+#
+#   BASELINE      baseline file (default: baseline.tsv)
+#   RUNS          runs of each workload (default: 5)
+#   PERF_UPDATE   when set to 1, record the baseline from the current
+#                 medians of the checks below instead of comparing
+#
+# Anything else in the environment (DEDUP, BENCH_DIR, TIME, ...) is passed
+# through to bench.sh. Baseline values are machine specific, record them on
+# the machine that runs the check with `make perf-baseline`.
+
+set -eu
+
+BASELINE=${BASELINE:-baseline.tsv}
+RUNS=${RUNS:-5}
+PERF_UPDATE=${PERF_UPDATE:-0}
+
+# workload, threads, metric, and tolerance in percent of each check recorded
+# by `make perf-baseline`
+CHECKS='scan 4 files_per_s 15
+scan 4 mb_per_s 15
+scan 4 peak_rss_kb 10
+group 4 files_per_s 15
+group 4 mb_per_s 15
+group 4 peak_rss_kb 10'
+
+results="$(mktemp)"
+rows="$(mktemp)"
+updated="$(mktemp)"
+trap 'rm -f "$results" "$rows" "$updated"' EXIT
+
+head -n 1 "$BASELINE" > "$updated"
+if [ "$PERF_UPDATE" = 1 ]; then
+    printf '%s\n' "$CHECKS" | awk '{ printf "%s\t%s\t%s\t-\t%s\n", $1, $2, $3, $4 }' > "$rows"
+else
+    tail -n +2 "$BASELINE" > "$rows"
+    if [ ! -s "$rows" ]; then
+        echo "$BASELINE has no values, record them on this machine with \`make perf-baseline\`" >&2
+        exit 1
+    fi
+fi
+
+workloads="$(awk -F'\t' '!seen[$1]++ { print $1 }' "$rows")"
+threads="$(awk -F'\t' '!seen[$2]++ { print $2 }' "$rows")"
+
+RESULTS="$results" RUNS="$RUNS" WORKLOADS="$workloads" THREADS="$threads" \
+    ./bench.sh > /dev/null
+
+# median of `metric` over the runs of `workload` at `threads`
+median() {
+    awk -F'\t' -v workload="$1" -v threads="$2" -v metric="$3" '
+        NR == 1 { for (i = 1; i <= NF; i++) if ($i == metric) column = i; next }
+        $2 == workload && $3 == threads { print $column }' "$results" |
+        sort -n |
+        awk '{ v[NR] = $1 } END { print NR % 2 ? v[(NR + 1) / 2] : (v[NR / 2] + v[NR / 2 + 1]) / 2 }'
+}
+
+printf '%-8s %7s %-12s %12s %12s %8s %9s  %s\n' \
+    workload threads metric baseline current delta tolerance result
+
+failed=0
+while IFS="$(printf '\t')" read -r workload threads metric value tolerance; do
+    current="$(median "$workload" "$threads" "$metric")"
+    printf '%s\t%s\t%s\t%s\t%s\n' "$workload" "$threads" "$metric" "$current" "$tolerance" >> "$updated"
+    if [ "$PERF_UPDATE" = 1 ]; then
+        printf '%-8s %7d %-12s %12s %12.1f\n' "$workload" "$threads" "$metric" - "$current"
+        continue
+    fi
+
+    # peak memory regresses when it grows, throughput when it shrinks
+    awk -v workload="$workload" -v threads="$threads" -v metric="$metric" \
+        -v baseline="$value" -v current="$current" -v tolerance="$tolerance" '
+        BEGIN {
+            delta = baseline ? (current - baseline) / baseline * 100 : 0
+            worse = metric ~ /rss/ ? delta : -delta
+            result = worse > tolerance ? "FAIL" : "ok"
+            printf "%-8s %7d %-12s %12.1f %12.1f %+7.1f%% %8.1f%%  %s\n",
+                workload, threads, metric, baseline, current, delta, tolerance, result
+            exit result == "FAIL"
+        }' || failed=1
+done < "$rows"
+
+if [ "$PERF_UPDATE" = 1 ]; then
+    cp "$updated" "$BASELINE"
+    echo "updated $BASELINE"
+    exit 0
+fi
+
+exit "$failed"
@@ -26,17 +26,12 @@
 
 #include <sys/attr.h>
 #if defined(__APPLE__)
-#include <sys/clonefile.h>
 #include <copyfile.h>
 #endif
 #include <sys/stat.h>
-#if defined(__FREEBSD__)
-#include <sys/ioctl.h>
-#endif
 
 #include <err.h>
 #include <errno.h>
-#include <fcntl.h>
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -44,14 +39,18 @@
 #include <unistd.h>
 
 #include "clone.h"
+#include "stats.h"
+#include "vfs.h"
 
 static int find_zero_file(const char* restrict path) {
-    if (access(path, W_OK)) {
+    stats_syscall(STATS_SYSCALL_STAT);
+    if (vfs->access(path, W_OK)) {
         return 1;
     }
 
     struct stat s = { 0 };
-    if (stat(path, &s)) {
+    stats_syscall(STATS_SYSCALL_STAT);
+    if (vfs->stat(path, &s)) {
         fprintf(stderr, "Could not stat %s\n", path);
         perror("stat(2)");
         return 2;
@@ -86,7 +85,8 @@ char* tmp_name(const char* restrict path, char* restrict out, size_t size) {
         return NULL;
     }
 
-    if (access(out, F_OK) == 0) {
+    stats_syscall(STATS_SYSCALL_STAT);
+    if (vfs->access(out, F_OK) == 0) {
         fprintf(stderr,
                 "Staging file %s already exists. Remove it to replace %s with a clone\n",
                 out,
@@ -99,126 +99,48 @@ char* tmp_name(const char* restrict path, char* restrict out, size_t size) {
 }
 
 static int genfile_clone(const char* src, const char* dst) {
-#if defined(__APPLE__)
-    return clonefile(src, dst, 0);
-#elif defined(__FREEBSD__)
-    // n.b.! This is completely untested and probably erases
-    //       everything it touches. There are currently no
-    //       equivalents to volume capability checks on the
-    //       frontend, so it's not even clear that the files
-    //       that are being passed in here are on a partition
-    //       that can be cloned.
-    int src_fd = open(src, O_RDONLY);
-    if (src_fd < 0) {
-        perror("open(2) failed");
-        return errno;
-    }
-    int dst_fd = open(dst, O_WRONLY | O_CREAT | O_EXCL);
-    if (dst_fd < 0) {
-        close(src_fd);
-        perror("open(2) failed");
-        return errno;
-    }
-    result = ioctl(dst_fd, CF_FICLONE, src_fd);
-    int errno_saved = errno;
-    close(src_fd);
-    close(dst_fd);
-    errno = errno_saved;
-    return result;
-#else
-#error Operating system not supported.
-#endif
+    stats_syscall(STATS_SYSCALL_CLONE);
+    return vfs->clone(src, dst);
 }
 
-// get the parent directory mtime and return it and a file descriptor
-// for the directory. if return is 0, caller is responsible for closing
-// the returned fd
-static int dir_mtime(const char* path, int* fd_out, struct timespec* mtime_out) {
-    char buffer[PATH_MAX] = { 0 };
-    char* parent = dirname_r(path, buffer);
-    if (!parent) {
-        perror("dirname_r");
-        return -1;
-    }
-
-    int fd = open(parent, O_RDONLY);
-    if (fd == -1) {
-        perror("open parent dir");
-        return -1;
-    }
-
-    struct stat st;
-    if (fstat(fd, &st) == -1) {
-        perror("fstat parent dir");
-        close(fd);
-        return -1;
-    }
-
-    *fd_out = fd;
-    *mtime_out = st.st_mtimespec;
-    return 0;
-}
-
-// restore the provided mtime to the provided fd. fd is closed
-// before the function returns
-static void restore_dir_mtime(int fd, struct timespec mtime) {
-    struct timespec times[2] = {
-        // omit atime
-        { .tv_sec = 0, .tv_nsec = UTIME_OMIT },
-        mtime,
-    };
-    if (futimens(fd, times) == -1) {
-        switch (errno) {
-        case EPERM:
-            fprintf(stderr, "Warning: cannot preserve parent mtime, permission denied\n");
-            break;
-        case EROFS:
-            fprintf(stderr, "Warning: cannot preserve parent mtime, filesystem is read-only\n");
-            break;
-        default:
-            perror("Warning: futimens");
-            break;
-        }
-    }
-    close(fd);
-}
-
-#ifdef DEBUG
-#define COPYFILE_DEBUG (1<<31)
-#else
-#define COPYFILE_DEBUG (0)
-#endif
-
 int replace_with_clone(const char* src, const char* dst, bool preserve_parent_mtime) {
     int parent_fd = -1;
     struct timespec saved_mtime = { 0 };
 
     if (preserve_parent_mtime &&
-        dir_mtime(dst, &parent_fd, &saved_mtime) == -1) {
+        vfs->parent_mtime(dst, &parent_fd, &saved_mtime) == -1) {
         return errno;
     }
 
     int result = 0;
 
     char path[PATH_MAX] = { 0 };
-    if (!tmp_name(dst, path, PATH_MAX)) {
+    StatsSpan step = stats_begin(STATS_APPLY_STAGE);
+    char* staged = tmp_name(dst, path, PATH_MAX);
+    stats_end(&step);
+    if (!staged) {
         result = errno;
         goto cleanup;
     }
 
     errno = 0;
+    step = stats_begin(STATS_APPLY_CLONE);
     result = genfile_clone(src, path);
+    stats_end(&step);
 
     if (result) {
         perror("could not clonefile");
-        unlink(path); // if it exists
+        vfs->unlink(path); // if it exists
         goto cleanup;
     }
 
-    if (find_zero_file(path)) {
+    step = stats_begin(STATS_APPLY_VERIFY);
+    int invalid = find_zero_file(path);
+    stats_end(&step);
+    if (invalid) {
         fprintf(stderr,
                 "invalid file created by clonefile(2)\n");
-        unlink(path);
+        vfs->unlink(path);
         result = ENOENT;
         goto cleanup;
     }
@@ -226,31 +148,33 @@ int replace_with_clone(const char* src, const char* dst, bool preserve_parent_mt
 #if defined(__APPLE__)
     // TODO: use COPYFILE_CHECK during dry-run and
     //       higher verbosity levels
-    int check = copyfile(dst,
-                         path,
-                         NULL,
-                         COPYFILE_CHECK | COPYFILE_METADATA);
+    step = stats_begin(STATS_APPLY_METADATA);
+    stats_syscall(STATS_SYSCALL_COPYFILE);
+    int check = vfs->copy_metadata(dst, path, true);
     if (check & COPYFILE_DATA) {
+        stats_end(&step);
         perror("copyfile(3) should not copy data");
-        unlink(path);
+        vfs->unlink(path);
         result = check;
         goto cleanup;
     }
 
-    result = copyfile(dst,
-                      path,
-                      NULL,
-                      COPYFILE_METADATA | COPYFILE_DEBUG);
+    stats_syscall(STATS_SYSCALL_COPYFILE);
+    result = vfs->copy_metadata(dst, path, false);
+    stats_end(&step);
     if (result) {
         perror("could not copy metadata");
-        unlink(path);
+        vfs->unlink(path);
         goto cleanup;
     }
 
-    if (find_zero_file(path)) {
+    step = stats_begin(STATS_APPLY_VERIFY);
+    invalid = find_zero_file(path);
+    stats_end(&step);
+    if (invalid) {
         fprintf(stderr,
                 "invalid file created by copyfile(3)\n");
-        unlink(path);
+        vfs->unlink(path);
         result = ENOENT;
         goto cleanup;
     }
@@ -261,41 +185,108 @@ int replace_with_clone(const char* src, const char* dst, bool preserve_parent_mt
     // TODO: use COPYFILE_CHECK to verify that nothing
     //       would be copied back to the original file
 
-    result = rename(path, dst);
+    step = stats_begin(STATS_APPLY_RENAME);
+    stats_syscall(STATS_SYSCALL_RENAME);
+    result = vfs->rename(path, dst);
+    stats_end(&step);
     if (result) {
         perror("could not replace existing file");
-        unlink(path);
+        vfs->unlink(path);
         goto cleanup;
     }
 
 cleanup:
     if (preserve_parent_mtime) {
-        restore_dir_mtime(parent_fd, saved_mtime);
+        vfs->restore_parent_mtime(parent_fd, saved_mtime);
     }
     return result;
 }
 
+int replace_with_contiguous_copy(const char* path, bool preserve_parent_mtime) {
+    int parent_fd = -1;
+    struct timespec saved_mtime = { 0 };
+
+    if (preserve_parent_mtime &&
+        vfs->parent_mtime(path, &parent_fd, &saved_mtime) == -1) {
+        return errno;
+    }
+
+    int result = 0;
+
+    char staged[PATH_MAX] = { 0 };
+    StatsSpan step = stats_begin(STATS_APPLY_STAGE);
+    char* name = tmp_name(path, staged, PATH_MAX);
+    stats_end(&step);
+    if (!name) {
+        result = errno;
+        goto cleanup;
+    }
+
+    step = stats_begin(STATS_APPLY_CLONE);
+    stats_syscall(STATS_SYSCALL_COPYFILE);
+    result = vfs->copy_contiguous(path, staged);
+    stats_end(&step);
+    if (result) {
+        perror("could not copy file");
+        vfs->unlink(staged); // if it exists
+        goto cleanup;
+    }
+
+    step = stats_begin(STATS_APPLY_METADATA);
+    stats_syscall(STATS_SYSCALL_COPYFILE);
+    result = vfs->copy_metadata(path, staged, false);
+    stats_end(&step);
+    if (result) {
+        perror("could not copy metadata");
+        vfs->unlink(staged);
+        goto cleanup;
+    }
+
+    step = stats_begin(STATS_APPLY_RENAME);
+    stats_syscall(STATS_SYSCALL_RENAME);
+    result = vfs->rename(staged, path);
+    stats_end(&step);
+    if (result) {
+        perror("could not replace existing file");
+        vfs->unlink(staged);
+        goto cleanup;
+    }
+
+cleanup:
+    if (preserve_parent_mtime) {
+        vfs->restore_parent_mtime(parent_fd, saved_mtime);
+    }
+    return result;
+}
 
 int replace_with_link(const char* src, const char* dst) {
     // TODO: should this atomically move a tmp file instead of
     //       two step an unlink and link?
-    if (unlink(dst)) {
+    StatsSpan step = stats_begin(STATS_APPLY_RENAME);
+    stats_syscall(STATS_SYSCALL_UNLINK);
+    int r = vfs->unlink(dst);
+    stats_end(&step);
+    if (r) {
         warn("%s", dst);
         return 1;
     }
 
-    return link(src, dst);
+    step = stats_begin(STATS_APPLY_CLONE);
+    stats_syscall(STATS_SYSCALL_LINK);
+    r = vfs->link(src, dst);
+    stats_end(&step);
+    return r;
 }
 
 // returns a relative path to dst from src
 char* path_relative_to(const char* src, const char* dst) {
-    char* real_src = realpath(src, NULL);
+    char* real_src = vfs->realpath(src);
     if (real_src == NULL) {
         fprintf(stderr, "%s could not be resolved to a canonical path.\n", src);
         return NULL;
     }
 
-    char* real_dst = realpath(dst, NULL);
+    char* real_dst = vfs->realpath(dst);
     if (real_dst == NULL) {
         free(real_src);
         fprintf(stderr, "%s could not be resolved to a canonical path.\n", dst);
@@ -370,12 +361,20 @@ int replace_with_symlink(const char* src, const char* dst) {
 
     // TODO: should this atomically move a tmp file instead of
     //       two step an unlink and link?
-    if (unlink(dst)) {
+    StatsSpan step = stats_begin(STATS_APPLY_RENAME);
+    stats_syscall(STATS_SYSCALL_UNLINK);
+    int r = vfs->unlink(dst);
+    stats_end(&step);
+    if (r) {
         free(path);
         warn("%s", dst);
         return 1;
     }
-    int r = symlink(path, dst);
+
+    step = stats_begin(STATS_APPLY_CLONE);
+    stats_syscall(STATS_SYSCALL_LINK);
+    r = vfs->symlink(path, dst);
+    stats_end(&step);
 
     free(path);
 
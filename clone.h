@@ -53,6 +53,19 @@
 /// See also: `clonefile(2)`, `copyfile(2)`, or `rename(2)`
 int replace_with_clone(const char* src, const char* dst, bool preserve_parent_mtime);
 
+/// replace_with_contiguous_copy
+///
+/// The `replace_with_contiguous_copy` function causes the link named `path`
+/// to be replaced with a copy of itself whose space is allocated before it
+/// is written, so its data is stored as contiguously as the volume allows.
+/// Metadata is retained as with `replace_with_clone`. Any clones of `path`
+/// are unaffected and keep sharing the old blocks.
+///
+/// On success 0 is returned. On failure `path` is left as it was and any
+/// error returned by `tmp_name`, `copy_contiguous`, `copyfile(2)`, or
+/// `rename(2)` is returned.
+int replace_with_contiguous_copy(const char* path, bool preserve_parent_mtime);
+
 /// replace_with_link
 ///
 /// The `replae_with_link` function causes the link named `dst` to be
@@ -0,0 +1,61 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <stdlib.h>
+
+#include "counters.h"
+
+Counters* new_counters(size_t shard_count) {
+    Counters* counters = malloc(sizeof(Counters));
+    counters->shard_count = shard_count;
+    counters->shards = aligned_alloc(COUNTER_SHARD_ALIGNMENT,
+                                     shard_count * sizeof(CounterShard));
+    for (size_t i = 0; i < shard_count; i++) {
+        for (size_t c = 0; c < COUNTER_COUNT; c++) {
+            atomic_init(&counters->shards[i].values[c], 0);
+        }
+    }
+
+    return counters;
+}
+
+void free_counters(Counters* counters) {
+    free(counters->shards);
+    free(counters);
+}
+
+CounterShard* counters_shard(Counters* counters, size_t index) {
+    return &counters->shards[index];
+}
+
+uint64_t counters_sum(const Counters* counters, Counter counter) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < counters->shard_count; i++) {
+        sum += atomic_load_explicit(&counters->shards[i].values[counter],
+                                    memory_order_relaxed);
+    }
+    return sum;
+}
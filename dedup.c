@@ -48,61 +48,133 @@ static char sccsid[] = "@(#)dedup.c)";
 
 #include <assert.h>
 #include <err.h>
+#include <errno.h>
 #include <fts.h>
 #include <getopt.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "clone.h"
+#include "counters.h"
 #include "map.h"
+#include "probes.h"
 #include "progress.h"
 #include "queue.h"
+#include "record.h"
+#include "stats.h"
 #include "utils.h"
+#include "vfs.h"
 
 #define PROGRESS_LOCK(p, m, block) do { \
         if ((p)) { \
-            pthread_mutex_lock((m)); \
-            block; \
-            pthread_mutex_unlock((m)); \
+            STATS_LOCKED((m), "progress_mutex", block); \
         } \
     } while (0)
 
+// probing is mostly waiting on the filesystem, so far more probe threads
+// than cores can be useful
+#define PROBE_THREADS_MAX 1024
+
+// files on each of this many devices are evaluated by a pool of threads of
+// their own. files on any other device share one more pool, which treats
+// them all as if they were not on rotational disks.
+#define DEVICE_POOLS_MAX 16
+
 typedef enum ReplaceMode {
     DEDUP_CLONE    = 0,
     DEDUP_LINK     = 1,
     DEDUP_SYMLINK  = 2,
 } ReplaceMode;
 
+typedef struct DevicePool DevicePool;
+typedef struct ApplyPool ApplyPool;
+
 typedef struct DedupContext {
     Progress* progress;
-    FileEntryHead* queue;
-    rb_tree_t* visited;
     rb_tree_t* duplicates;
-    size_t found;
-    size_t saved;
-    size_t already_saved;
-    uint8_t done;
+    Counters* counters;
+    DevicePool* pools[DEVICE_POOLS_MAX + 1];
+    size_t pool_count;
+    // replaces files alongside the main thread, if there are threads to
+    ApplyPool* apply_pool;
+    // threads per device pool
     uint8_t thread_count;
+    unsigned probe_threads;
     bool dry_run;
     uint8_t verbosity;
     bool force;
     bool preserve_parent_mtime;
     ReplaceMode replace_mode;
-    pthread_mutex_t metrics_mutex;
+    // rewrite an origin stored in more than this many fragments. 0 disables
+    size_t defragment;
     pthread_mutex_t progress_mutex;
-    pthread_mutex_t queue_mutex;
-    pthread_mutex_t visited_mutex;
     pthread_mutex_t duplicates_mutex;
-    pthread_mutex_t done_mutex;
 } DedupContext;
 
-
-void visit_entry(FileEntry* fe, Progress* p, DedupContext* ctx) {
-
-    FileMetadata* fm = metadata_from_entry(fe);
+typedef struct DedupWorker {
+    DedupContext* context;
+    DevicePool* pool;
+    CounterShard* counters;
+    unsigned id;
+    // set for the main thread, which visits the entries of pools without
+    // workers itself. a worker cannot tell by the pool's `thread_count`,
+    // which may not count it yet when it starts.
+    bool main_thread;
+} DedupWorker;
+
+/// The queues, threads, and visited tree which evaluate the files on one
+/// device, so a slow device only ever holds up the threads of its own pool.
+/// Pools are started by the main thread when the walk finds the first file
+/// on their device.
+struct DevicePool {
+    dev_t device;
+    // set if the device seeks. its files are held until the walk is done,
+    // then visited by a single thread in the order they are stored.
+    bool rotational;
+    FileEntryHead* queue;
+    // entries probed by probe threads, if there are any
+    FileEntryHead* probed;
+    atomic_bool done;
+    atomic_bool probing_done;
+    // threads that were started
+    unsigned thread_count;
+    unsigned probe_threads;
+    pthread_mutex_t queue_mutex;
+    // signalled when an entry is appended to `queue` or it is done, for
+    // probe threads, which are too many to poll it
+    pthread_cond_t queue_ready;
+    pthread_mutex_t probed_mutex;
+    DedupWorker* workers;
+    pthread_t* threads;
+    DedupWorker* probers;
+    pthread_t* probe_thread_ids;
+    // files on another device can never have the same content, so each pool
+    // has a tree and lock of its own
+    rb_tree_t* visited;
+    pthread_mutex_t visited_mutex;
+};
+
+void visit_entry(FileEntry* fe, DedupWorker* w) {
+    DedupContext* ctx = w->context;
+    CounterShard* counters = w->counters;
+    uint64_t visit_started = DEDUP_VISIT_ENTRY_ENABLED() ? stats_now() : 0;
+
+    FileMetadata* fm = NULL;
+    if (fe->probed) {
+        // ownership transferred from the entry
+        fm = fe->fm;
+        fe->fm = NULL;
+        errno = fe->error;
+    } else {
+        StatsSpan probe = stats_begin(STATS_PROBE);
+        probe.size = fe->size;
+        fm = metadata_from_entry(fe);
+        stats_end(&probe);
+    }
 
     if (!fm) {
         PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
@@ -115,39 +187,42 @@ void visit_entry(FileEntry* fe, Progress* p, DedupContext* ctx) {
         return;
     }
 
-    pthread_mutex_lock(&ctx->visited_mutex);
-    FileMetadata* old = visited_tree_insert(ctx->visited, fm);
-    old = metadata_dup(old);
-    pthread_mutex_unlock(&ctx->visited_mutex);
+    counter_add(counters, COUNTER_PROBED_BYTES, fm->size);
+
+    size_t hashed = 0;
+    FileMetadata* old = visited_tree_insert_shared(w->pool->visited,
+                                                   &w->pool->visited_mutex,
+                                                   fm,
+                                                   &hashed);
+
+    counter_add(counters, COUNTER_HASHED_BYTES, hashed);
 
     if (old) {
-        pthread_mutex_lock(&ctx->duplicates_mutex);
-        AList* list = duplicate_tree_find(ctx->duplicates, fm);
-        if (alist_empty(list)) {
-            alist_add(list, metadata_dup(old));
-        }
+        STATS_LOCKED(&ctx->duplicates_mutex, "duplicates_mutex", {
+            AList* list = duplicate_tree_find(ctx->duplicates, fm);
+            if (alist_empty(list)) {
+                alist_add(list, metadata_dup(old));
+            }
 
-        if (ctx->verbosity) {
-            PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
-                clear_progress();
-                printf("%s has %zu duplicates\n",
-                       fm->path,
-                       alist_size(list));
-                for (size_t i = 0; i < alist_size(list); i++) {
-                    printf("\t%s\n",
-                           ((FileMetadata*) alist_get(list, i))->path);
-                }
-            });
-        }
+            if (ctx->verbosity) {
+                PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+                    clear_progress();
+                    printf("%s has %zu duplicates\n",
+                           fm->path,
+                           alist_size(list));
+                    for (size_t i = 0; i < alist_size(list); i++) {
+                        printf("\t%s\n",
+                               ((FileMetadata*) alist_get(list, i))->path);
+                    }
+                });
+            }
 
-        // ownership transferred to the list
-        alist_add(list, fm);
-        pthread_mutex_unlock(&ctx->duplicates_mutex);
+            // ownership transferred to the list
+            alist_add(list, fm);
+        });
 
-        if (fm->clone_id != old->clone_id) {
-            pthread_mutex_lock(&ctx->metrics_mutex);
-            ctx->found++;
-            pthread_mutex_unlock(&ctx->metrics_mutex);
+        if (!fm->clone_id || fm->clone_id != old->clone_id) {
+            counter_add(counters, COUNTER_FOUND, 1);
             if (ctx->verbosity > 1) {
                 PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
                     clear_progress();
@@ -155,7 +230,7 @@ void visit_entry(FileEntry* fe, Progress* p, DedupContext* ctx) {
                            old->path,
                            fm->path,
                            fm->size,
-                           ctx->found);
+                           counters_sum(ctx->counters, COUNTER_FOUND));
                 });
             }
         }
@@ -163,21 +238,200 @@ void visit_entry(FileEntry* fe, Progress* p, DedupContext* ctx) {
     } else {
         free_metadata(fm);
     }
+
+    if (DEDUP_VISIT_ENTRY_ENABLED()) {
+        DEDUP_VISIT_ENTRY(fe->path, fe->size, stats_now() - visit_started);
+    }
+}
+
+static void complete_entry(FileEntry* fe, DedupWorker* w) {
+    counter_add(w->counters, COUNTER_COMPLETED_UNITS, 1);
+    counter_add(w->counters, COUNTER_COMPLETED_BYTES, fe->size);
+    file_entry_free(fe);
+}
+
+static void visit_and_free_entry(FileEntry* fe, DedupWorker* w) {
+    visit_entry(fe, w);
+    complete_entry(fe, w);
+}
+
+// probe threads only open, read, and get the clone ids of files and pass them
+// on to the workers, so on filesystems where each of those is a round trip
+// many can be waiting at once without contending for the visited tree.
+void* probe_work(void* worker) {
+    DedupWorker* w = worker;
+    DevicePool* pool = w->pool;
+
+    if (trace_enabled) {
+        char name[32];
+        snprintf(name, sizeof(name), "prober %u", w->id);
+        trace_thread_name(name);
+    }
+
+    while (true) {
+        // not `STATS_LOCKED`, which would count time spent waiting for an
+        // entry as time the mutex was held
+        FileEntry* fe = NULL;
+        pthread_mutex_lock(&pool->queue_mutex);
+        while (!(fe = file_entry_next(pool->queue)) &&
+               !atomic_load_explicit(&pool->done, memory_order_acquire)) {
+            pthread_cond_wait(&pool->queue_ready, &pool->queue_mutex);
+        }
+        pthread_mutex_unlock(&pool->queue_mutex);
+
+        if (!fe) {
+            break;
+        }
+
+        StatsSpan probe = stats_begin(STATS_PROBE);
+        probe.size = fe->size;
+        fe->fm = metadata_from_entry(fe);
+        fe->error = errno;
+        fe->probed = true;
+        stats_end(&probe);
+
+        STATS_LOCKED(&pool->probed_mutex, "probed_mutex", {
+            file_entry_queue_push(pool->probed, fe);
+        });
+    }
+
+    return NULL;
+}
+
+// an entry on a disk that seeks, and where its data starts
+typedef struct PlacedEntry {
+    FileEntry* fe;
+    uint64_t offset;
+    bool located;
+} PlacedEntry;
+
+// orders entries by device, then by where they are stored. entries that
+// could not be located follow in inode order, which roughly follows the
+// order they were created in.
+static int compare_placed_entries(const void* a, const void* b) {
+    const PlacedEntry* x = a, * y = b;
+    if (x->fe->device != y->fe->device) {
+        return x->fe->device < y->fe->device ? -1 : 1;
+    }
+    if (x->located != y->located) {
+        return x->located ? -1 : 1;
+    }
+    uint64_t k1 = x->located ? x->offset : x->fe->inode,
+             k2 = y->located ? y->offset : y->fe->inode;
+    return k1 < k2 ? -1 : k1 > k2;
+}
+
+static int compare_entry_sizes(const void* a, const void* b) {
+    const PlacedEntry* x = a, * y = b;
+    if (x->fe->device != y->fe->device) {
+        return x->fe->device < y->fe->device ? -1 : 1;
+    }
+    return x->fe->size < y->fe->size ? -1 : x->fe->size > y->fe->size;
 }
 
-void* dedup_work(void* ctx) {
-    DedupContext* c = ctx;
-    uint8_t done = c->done;
+// visits the entries of `w`'s pool, once they have all been found, in the
+// order they are stored in. several threads reading files wherever they were
+// found in the walk would seek back and forth between them. a file no other
+// file on its device has the size of cannot be a duplicate, so it is neither
+// located nor read.
+static void visit_in_physical_order(DedupWorker* w) {
+    FileEntryHead* entries = w->pool->queue;
+    size_t count = 0;
+    FileEntry* fe = NULL;
+    STAILQ_FOREACH(fe, entries, entries) {
+        count++;
+    }
+
+    PlacedEntry* placed = calloc(count ?: 1, sizeof(PlacedEntry));
+    if (!placed) {
+        // without room to sort them, entries are visited as they were found
+        while ((fe = file_entry_next(entries))) {
+            visit_and_free_entry(fe, w);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        placed[i] = (PlacedEntry) { .fe = file_entry_next(entries) };
+    }
+    qsort(placed, count, sizeof(PlacedEntry), compare_entry_sizes);
+
+    size_t shared = 0;
+    bool previous_matches = false;
+    for (size_t i = 0; i < count; i++) {
+        fe = placed[i].fe;
+        bool next_matches = i + 1 < count &&
+            !compare_entry_sizes(&placed[i], &placed[i + 1]);
+        if (previous_matches || next_matches) {
+            placed[shared] = placed[i];
+            placed[shared].located = !vfs->physical_offset(fe->path, &placed[shared].offset);
+            shared++;
+        } else {
+            complete_entry(fe, w);
+        }
+        previous_matches = next_matches;
+    }
+    count = shared;
+    qsort(placed, count, sizeof(PlacedEntry), compare_placed_entries);
+
+    for (size_t i = 0; i < count; i++) {
+        visit_and_free_entry(placed[i].fe, w);
+    }
+    free(placed);
+}
+
+void* dedup_work(void* worker) {
+    DedupWorker* w = worker;
+    DevicePool* pool = w->pool;
+
+    // with probe threads, workers take entries after they have been probed
+    atomic_bool* queue_done = pool->probe_threads ? &pool->probing_done : &pool->done;
+
+    if (trace_enabled && !w->main_thread) {
+        char name[32];
+        snprintf(name, sizeof(name), "worker %u", w->id);
+        trace_thread_name(name);
+    }
+
+    if (pool->rotational) {
+        // without workers, the main thread visits the entries once the walk
+        // is done instead of as each is appended
+        if (w->main_thread &&
+            !atomic_load_explicit(&pool->done, memory_order_acquire)) {
+            return NULL;
+        }
+        pthread_mutex_lock(&pool->queue_mutex);
+        while (!atomic_load_explicit(&pool->done, memory_order_acquire)) {
+            pthread_cond_wait(&pool->queue_ready, &pool->queue_mutex);
+        }
+        pthread_mutex_unlock(&pool->queue_mutex);
+
+        visit_in_physical_order(w);
+        return NULL;
+    }
+
+    while (true) {
+        // `done` is only set after the last entry is appended, so it must be
+        // read before the queue to know that an empty queue is final.
+        bool done = atomic_load_explicit(queue_done, memory_order_acquire);
+
+        uint64_t pop_started = DEDUP_QUEUE_POP_ENABLED() ? stats_now() : 0;
+        FileEntry* fe = NULL;
+        if (pool->probe_threads) {
+            STATS_LOCKED(&pool->probed_mutex, "probed_mutex", {
+                fe = file_entry_next(pool->probed);
+            });
+        } else {
+            STATS_LOCKED(&pool->queue_mutex, "queue_mutex", {
+                fe = file_entry_next(pool->queue);
+            });
+        }
 
-    while (!done) {
-        pthread_mutex_lock(&c->queue_mutex);
-        FileEntry* fe = file_entry_next(c->queue);
-        pthread_mutex_unlock(&c->queue_mutex);
+        if (fe && DEDUP_QUEUE_POP_ENABLED()) {
+            DEDUP_QUEUE_POP(fe->path, fe->size, stats_now() - pop_started);
+        }
 
         if (!fe) {
-            pthread_mutex_lock(&c->done_mutex);
-            done = c->done;
-            pthread_mutex_unlock(&c->done_mutex);
             if (done) {
                 break;
             }
@@ -185,24 +439,422 @@ void* dedup_work(void* ctx) {
             continue;
         }
 
-        visit_entry(fe, c->progress, c);
-        file_entry_free(fe);
+        visit_and_free_entry(fe, w);
 
-        PROGRESS_LOCK(c->progress, &c->progress_mutex, {
-            c->progress->completedUnitCount++;
-            display_progress(c->progress);
-        });
+        // without workers, the main thread visits each entry once it is
+        // appended
+        if (w->main_thread) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void free_device_pool(DevicePool* pool) {
+    if (pool->visited) {
+        free_visited_tree(pool->visited);
+    }
+    free_file_entry_queue(pool->queue);
+    free_file_entry_queue(pool->probed);
+    free(pool->workers);
+    free(pool->threads);
+    free(pool->probers);
+    free(pool->probe_thread_ids);
+    free(pool);
+}
 
-        if (c->thread_count == 0) {
+// returns the pool for `device`, starting one if there is none, or NULL if
+// one cannot be allocated. a pool for a `rotational` device has a single
+// worker and no probe threads. devices past the first `DEVICE_POOLS_MAX`
+// share one more pool, which is never rotational, since a single worker
+// reading in physical order would hold up any fast devices sharing it. only
+// the main thread may call this.
+static DevicePool* device_pool(DedupContext* c, dev_t device, bool rotational) {
+    for (size_t i = 0; i < c->pool_count; i++) {
+        if (c->pools[i]->device == device) {
+            return c->pools[i];
+        }
+    }
+    if (c->pool_count > DEVICE_POOLS_MAX) {
+        return c->pools[DEVICE_POOLS_MAX];
+    }
+    if (c->pool_count == DEVICE_POOLS_MAX) {
+        warnx("More than %d devices: files on device %llu and any others share one pool",
+              DEVICE_POOLS_MAX,
+              (unsigned long long) device);
+        rotational = false;
+    }
+
+    size_t index = c->pool_count;
+    unsigned workers = rotational && c->thread_count ? 1 : c->thread_count,
+             probers = rotational || !c->thread_count ? 0 : c->probe_threads;
+    DevicePool* pool = calloc(1, sizeof(DevicePool));
+    if (!pool) {
+        return NULL;
+    }
+    *pool = (DevicePool) {
+        .device = device,
+        .rotational = rotational,
+        .queue = new_file_entry_queue(),
+        .probed = new_file_entry_queue(),
+        .done = false,
+        .probing_done = false,
+        .queue_mutex = PTHREAD_MUTEX_INITIALIZER,
+        .queue_ready = PTHREAD_COND_INITIALIZER,
+        .probed_mutex = PTHREAD_MUTEX_INITIALIZER,
+        // without worker threads everything is done on the main thread as
+        // it is found
+        .workers = calloc(workers ?: 1, sizeof(DedupWorker)),
+        .threads = calloc(workers ?: 1, sizeof(pthread_t)),
+        .probers = calloc(probers ?: 1, sizeof(DedupWorker)),
+        .probe_thread_ids = calloc(probers ?: 1, sizeof(pthread_t)),
+        .visited = new_visited_tree(),
+        .visited_mutex = PTHREAD_MUTEX_INITIALIZER,
+    };
+    if (!pool->queue || !pool->probed || !pool->workers || !pool->threads ||
+        !pool->probers || !pool->probe_thread_ids || !pool->visited) {
+        free_device_pool(pool);
+        return NULL;
+    }
+    c->pools[c->pool_count++] = pool;
+
+    // probe threads are started first, so if none can be, workers are
+    // started knowing to probe entries themselves
+    for (unsigned i = 0; i < probers; i++) {
+        pool->probers[i] = (DedupWorker) {
+            .context = c,
+            .pool = pool,
+            .id = index * c->probe_threads + i + 1,
+        };
+        int r = pthread_create(&pool->probe_thread_ids[i], NULL, probe_work, &pool->probers[i]);
+        if (r) {
+            warn("Could not create probe threads: error %i", r);
+            break;
+        }
+        pool->probe_threads++;
+    }
+
+    // worker shards follow the main thread's, `thread_count` for each pool
+    for (unsigned i = 0; i < workers; i++) {
+        size_t id = index * c->thread_count + i + 1;
+        pool->workers[i] = (DedupWorker) {
+            .context = c,
+            .pool = pool,
+            .counters = counters_shard(c->counters, id),
+            .id = id,
+        };
+        int r = pthread_create(&pool->threads[i], NULL, dedup_work, &pool->workers[i]);
+        if (r) {
+            warn("Could not create threads: error %i\nRunning single threaded.",
+                 r);
             break;
         }
+        pool->thread_count++;
+    }
+
+    // the chunks of very large files are hashed by a pool shared by every
+    // device, which grows by as many threads as each device has workers, so
+    // the last few files do not leave every other core idle
+    if (pool->thread_count > 1) {
+        hash_pool_add(pool->thread_count - 1);
+    }
+
+    return pool;
+}
+
+// waits for every thread in `pool` to finish the entries it was given
+static void finish_device_pool(DevicePool* pool) {
+    atomic_store_explicit(&pool->done, true, memory_order_release);
+    // probe threads check `done` with the mutex held before waiting
+    pthread_mutex_lock(&pool->queue_mutex);
+    pthread_cond_broadcast(&pool->queue_ready);
+    pthread_mutex_unlock(&pool->queue_mutex);
+
+    for (unsigned i = 0; i < pool->probe_threads; i++) {
+        assert(pool->probe_thread_ids[i] != NULL);
+        if (pthread_join(pool->probe_thread_ids[i], NULL)) {
+            fprintf(stderr, "Failed to wait for probe thread %u\n", i);
+        }
+    }
+    atomic_store_explicit(&pool->probing_done, true, memory_order_release);
+
+    for (unsigned i = 0; i < pool->thread_count; i++) {
+        // clang-analyzer thinks threads[i] can be NULL, but `pthread_t`
+        // is an opaque type (to us). if `pthread_create` is successful
+        // the API contract says we can pass that value to pthread_join.
+        // the assertion is less intrusive than suppressing the warning
+        // by checking for the _clang_analyzer macro
+        assert(pool->threads[i] != NULL);
+        if (pthread_join(pool->threads[i], NULL)) {
+            fprintf(stderr, "Failed to wait for thread %u\n", i);
+        }
+    }
+}
+
+static int compare_metadata_elements(const void* a, const void* b) {
+    return metadata_compare(*(FileMetadata* const*) a, *(FileMetadata* const*) b);
+}
+
+// orders sorted sets by their first file
+static int compare_sets(const void* a, const void* b) {
+    return metadata_compare(alist_get(*(AList* const*) a, 0),
+                            alist_get(*(AList* const*) b, 0));
+}
+
+typedef enum SkipReason {
+    SKIP_NONE,
+    SKIP_HARDLINKED,
+    SKIP_CLONED,
+    SKIP_IMMUTABLE,
+} SkipReason;
+
+// why `fm` is not replaced with a clone of `origin`, if it is not
+static SkipReason skip_reason(FileMetadata* fm, FileMetadata* origin, DedupContext* ctx) {
+    if (!ctx->force && fm->nlink > 1) {
+        return SKIP_HARDLINKED;
+    }
+    if ((ctx->replace_mode == DEDUP_CLONE && fm->clone_id && fm->clone_id == origin->clone_id) ||
+        (ctx->replace_mode == DEDUP_LINK && fm->inode == origin->inode)) {
+        return SKIP_CLONED;
+    }
+    if (fm->flags & UF_IMMUTABLE ||
+        fm->flags & SF_IMMUTABLE) {
+        return SKIP_IMMUTABLE;
+    }
+    return SKIP_NONE;
+}
+
+// the outcome of replacing one file of a set, reported once the whole set
+// has been applied
+typedef struct Replacement {
+    FileMetadata* fm;
+    // blocks freed by the replacement, if it worked
+    size_t freeable;
+    int result;
+    int error;
+    bool cloned;
+} Replacement;
+
+typedef struct ApplyBatch {
+    DedupContext* context;
+    FileMetadata* origin;
+    uint64_t origin_clone_id;
+    Replacement* replacements;
+    size_t count;
+    // replacements handed out and replacements applied, guarded by the
+    // mutex of the apply pool if there is one
+    size_t next;
+    size_t applied;
+} ApplyBatch;
+
+/// Threads that replace the files of each set alongside the main thread.
+/// They are started once, before the first set is deduplicated, and wait
+/// for a batch in between sets.
+struct ApplyPool {
+    pthread_mutex_t mutex;
+    // signalled when a batch is posted or the pool is stopped
+    pthread_cond_t ready;
+    // signalled when the last replacement of `batch` is applied
+    pthread_cond_t finished;
+    // the batch with replacements left to hand out, if any
+    ApplyBatch* batch;
+    bool stopping;
+    pthread_t* threads;
+    unsigned thread_count;
+};
+
+static void apply_replacement(ApplyBatch* b, Replacement* r) {
+    DedupContext* ctx = b->context;
+    FileMetadata* origin = b->origin;
+    FileMetadata* fm = r->fm;
+
+    // only blocks that no other file shares are freed by replacing
+    // a file. if other hardlinks remain, nothing is freed at all.
+    r->freeable = fm->nlink > 1 ? 0 : private_size(fm->path);
+
+    StatsSpan apply = stats_begin(STATS_APPLY);
+    apply.size = fm->size;
+    uint64_t replace_started = stats_now();
+    switch (ctx->replace_mode) {
+    case DEDUP_CLONE:
+        r->result = replace_with_clone(origin->path,
+                                       fm->path,
+                                       ctx->preserve_parent_mtime);
+        if (DEDUP_REPLACE_CLONE_ENABLED()) {
+            DEDUP_REPLACE_CLONE(origin->path, fm->path, fm->size,
+                                stats_now() - replace_started, r->result);
+        }
+        break;
+    case DEDUP_LINK:
+        r->result = replace_with_link(origin->path,
+                                      fm->path);
+        if (DEDUP_REPLACE_LINK_ENABLED()) {
+            DEDUP_REPLACE_LINK(origin->path, fm->path, fm->size,
+                               stats_now() - replace_started, r->result);
+        }
+        break;
+    case DEDUP_SYMLINK:
+        r->result = replace_with_symlink(origin->path,
+                                         fm->path);
+        if (DEDUP_REPLACE_SYMLINK_ENABLED()) {
+            DEDUP_REPLACE_SYMLINK(origin->path, fm->path, fm->size,
+                                  stats_now() - replace_started, r->result);
+        }
+        break;
+    }
+    r->error = errno;
+    stats_end(&apply);
+
+    if (r->result) {
+        return;
+    }
+
+    r->cloned = true;
+    if (ctx->replace_mode == DEDUP_CLONE) {
+        StatsSpan verify = stats_begin(STATS_APPLY_VERIFY);
+        // without both clone ids the clone cannot be checked, and the
+        // clone itself reported no error
+        uint64_t clone_id = get_clone_id(fm->path);
+        r->cloned = !clone_id || !b->origin_clone_id ||
+                    clone_id == b->origin_clone_id;
+        stats_end(&verify);
+    }
+
+    // a clone may still hold blocks of its own (e.g. if it was
+    // modified since it was evaluated)
+    if (r->cloned && ctx->replace_mode == DEDUP_CLONE && r->freeable) {
+        size_t remaining = private_size(fm->path);
+        r->freeable = r->freeable > remaining ? r->freeable - remaining : 0;
+    }
+}
+
+// hands out the next replacement of `b`, and takes `b` out of `pool` once
+// every replacement has been. `pool` may be `NULL`, otherwise its mutex must
+// be held.
+static bool take_replacement(ApplyPool* pool, ApplyBatch* b, size_t* i) {
+    if (b->next == b->count) {
+        return false;
+    }
+    *i = b->next++;
+    if (pool && b->next == b->count && pool->batch == b) {
+        pool->batch = NULL;
+    }
+    return true;
+}
+
+static void* apply_pool_work(void* context) {
+    ApplyPool* pool = context;
+
+    if (trace_enabled) {
+        trace_thread_name("apply");
     }
 
+    pthread_mutex_lock(&pool->mutex);
+    while (true) {
+        while (!pool->batch && !pool->stopping) {
+            pthread_cond_wait(&pool->ready, &pool->mutex);
+        }
+        ApplyBatch* b = pool->batch;
+        size_t i = 0;
+        if (!b || !take_replacement(pool, b, &i)) {
+            break;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        apply_replacement(b, &b->replacements[i]);
+        pthread_mutex_lock(&pool->mutex);
+        if (++b->applied == b->count) {
+            pthread_cond_signal(&pool->finished);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
     return NULL;
 }
 
+// starts up to `count` threads which replace files for the rest of the run.
+// returns `NULL` if none could be started.
+static ApplyPool* start_apply_pool(unsigned count) {
+    ApplyPool* pool = calloc(1, sizeof(ApplyPool));
+    if (!pool) {
+        return NULL;
+    }
+    *pool = (ApplyPool) {
+        .mutex = PTHREAD_MUTEX_INITIALIZER,
+        .ready = PTHREAD_COND_INITIALIZER,
+        .finished = PTHREAD_COND_INITIALIZER,
+        .threads = calloc(count, sizeof(pthread_t)),
+    };
+    for (unsigned i = 0; pool->threads && i < count; i++) {
+        // if a thread cannot be started, the rest are replaced without it
+        if (pthread_create(&pool->threads[i], NULL, apply_pool_work, pool)) {
+            break;
+        }
+        pool->thread_count++;
+    }
+    if (pool->thread_count == 0) {
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+static void stop_apply_pool(ApplyPool* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->ready);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (unsigned i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    free(pool);
+}
+
+// replaces every file in `b`. each file is replaced by one thread, one step
+// after another, but with an apply pool up to `thread_count` files are
+// replaced at once. the saved mtime of a parent directory would be stale if
+// another file in it were replaced meanwhile, so when it is preserved there
+// is no apply pool and files are replaced one at a time.
+static void apply_batch(ApplyBatch* b) {
+    ApplyPool* pool = b->count > 1 ? b->context->apply_pool : NULL;
+    size_t i = 0;
+    if (!pool) {
+        while (take_replacement(NULL, b, &i)) {
+            apply_replacement(b, &b->replacements[i]);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->batch = b;
+    pthread_cond_broadcast(&pool->ready);
+    while (take_replacement(pool, b, &i)) {
+        pthread_mutex_unlock(&pool->mutex);
+        apply_replacement(b, &b->replacements[i]);
+        pthread_mutex_lock(&pool->mutex);
+        b->applied++;
+    }
+    // the last replacements may still be applied by the pool
+    while (b->applied < b->count) {
+        pthread_cond_wait(&pool->finished, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
 size_t deduplicate(AList* metadata_set, DedupContext* ctx) {
+    // sets are deduplicated one at a time and reported by the main thread
+    CounterShard* counters = counters_shard(ctx->counters, 0);
+
+    // sets are built in the order files were visited, which depends on
+    // thread scheduling. a canonical order makes every choice below, and so
+    // the origin, the same from run to run, so files that already share the
+    // origin's blocks are never replaced again.
+    alist_sort(metadata_set, compare_metadata_elements);
+
     FileMetadata* origin = NULL;
+    size_t origin_fragments = SIZE_MAX;
     char* reason = NULL;
     // if there is a file with more than one hard link, use that as the
     // source candidate (optimally a hardlink with the most links)
@@ -216,15 +868,24 @@ size_t deduplicate(AList* metadata_set, DedupContext* ctx) {
 
     // otherwise, use the file with the most clones.
     if (!origin) {
+        // a clone id of 0 could not be read, and is not shared with any file
         rb_tree_t* clone_counts = new_clone_id_counts();
+        size_t unknown = 0;
         for (size_t i = 0; i < alist_size(metadata_set); i++) {
             FileMetadata* fm = alist_get(metadata_set, i);
-            clone_id_tree_increment(clone_counts, fm);
+            if (fm->clone_id == 0) {
+                unknown++;
+            } else {
+                clone_id_tree_increment(clone_counts, fm);
+            }
         }
 
-        if (rb_tree_count(clone_counts) == 1) {
+        if (unknown == 0 && rb_tree_count(clone_counts) == 1) {
             origin = alist_get(metadata_set, 0);
-            ctx->already_saved += origin->size * (alist_size(metadata_set) - 1);
+            for (size_t i = 1; i < alist_size(metadata_set); i++) {
+                FileMetadata* fm = alist_get(metadata_set, i);
+                counter_add(counters, COUNTER_ALREADY_SAVED, shared_size(fm->path));
+            }
             if (ctx->verbosity) {
                 printf("%s is already cloned to\n",
                        origin->path);
@@ -239,8 +900,10 @@ size_t deduplicate(AList* metadata_set, DedupContext* ctx) {
         }
 
         // none of the files are cloned (they all of a clone count of 1)
-        if (rb_tree_count(clone_counts) == alist_size(metadata_set)) {
-            // find the first file that is not compressed
+        if (rb_tree_count(clone_counts) + unknown == alist_size(metadata_set)) {
+            // find the least fragmented file that is not compressed. every
+            // other file will share its blocks, so reads of all of them will
+            // be as sequential as its layout is. ties go to the first.
             //
             // n.b.! transparently compressed files will have the UF_COMPRESSED
             //       flag set, compressed data in the resource fork, and an
@@ -248,6 +911,7 @@ size_t deduplicate(AList* metadata_set, DedupContext* ctx) {
             //       file is actually stored in metadata, these files cannot
             //       share data blocks, so they are worthless for using as
             //       clone origins.
+            size_t most_fragments = 0;
             for (size_t i = 0; i < alist_size(metadata_set); i++) {
                 FileMetadata* fm = alist_get(metadata_set, i);
                 if (fm->flags & UF_COMPRESSED) {
@@ -256,10 +920,24 @@ size_t deduplicate(AList* metadata_set, DedupContext* ctx) {
                     }
                     continue;
                 }
-                origin = fm;
-                reason = "first seen";
-                break;
+                size_t fragments = fragment_count(fm->path);
+                if (record_enabled) {
+                    record_fragments(fm->device, fm->inode, fragments);
+                }
+                if (ctx->verbosity > 1) {
+                    printf("%s is stored in %zu fragments\n", fm->path, fragments);
+                }
+                if (!origin || fragments < origin_fragments) {
+                    origin = fm;
+                    origin_fragments = fragments;
+                }
+                if (fragments != SIZE_MAX && fragments > most_fragments) {
+                    most_fragments = fragments;
+                }
             }
+            // if no file is known to be more fragmented, the first is
+            // chosen by its order alone
+            reason = origin_fragments < most_fragments ? "least fragmented" : "lowest inode";
 
             if (!origin) {
                 if (ctx->verbosity) {
@@ -285,8 +963,50 @@ size_t deduplicate(AList* metadata_set, DedupContext* ctx) {
            origin->path,
            reason);
 
-    uint64_t origin_clone_id = get_clone_id(origin->path);
+    // when even the best origin is badly fragmented, rewrite it contiguously
+    // first so that it and every file cloned from it read sequentially.
+    // the fragment count is only known if no file was linked or cloned.
+    if (ctx->defragment &&
+        origin_fragments != SIZE_MAX &&
+        origin_fragments > ctx->defragment &&
+        !(origin->flags & (UF_IMMUTABLE | SF_IMMUTABLE))) {
+        if (ctx->dry_run) {
+            printf("\tdefragmenting %s (%zu fragments)\n",
+                   origin->path,
+                   origin_fragments);
+        } else if (replace_with_contiguous_copy(origin->path, ctx->preserve_parent_mtime)) {
+            fprintf(stderr,
+                    "\tcould not defragment %s\n",
+                    origin->path);
+        } else {
+            printf("\tdefragmented %s (%zu fragments)\n",
+                   origin->path,
+                   origin_fragments);
+            origin->clone_id = get_clone_id(origin->path);
+        }
+    }
+
+    ApplyBatch batch = {
+        .context = ctx,
+        .origin = origin,
+        .origin_clone_id = get_clone_id(origin->path),
+        .replacements = calloc(alist_size(metadata_set), sizeof(Replacement)),
+    };
+    if (!batch.replacements) {
+        perror("calloc");
+        return 0;
+    }
+
+    // files are replaced all at once, then reported in order
+    for (size_t i = 0; !ctx->dry_run && i < alist_size(metadata_set); i++) {
+        FileMetadata* fm = alist_get(metadata_set, i);
+        if (fm != origin && skip_reason(fm, origin, ctx) == SKIP_NONE) {
+            batch.replacements[batch.count++].fm = fm;
+        }
+    }
+    apply_batch(&batch);
 
+    Replacement* r = batch.replacements;
     for (size_t i = 0; i < alist_size(metadata_set); i++) {
         FileMetadata* fm = alist_get(metadata_set, i);
 
@@ -294,81 +1014,72 @@ size_t deduplicate(AList* metadata_set, DedupContext* ctx) {
             continue;
         }
 
-        if (!ctx->force && fm->nlink > 1) {
+        switch (skip_reason(fm, origin, ctx)) {
+        case SKIP_HARDLINKED:
             printf("\tskipping %s, hardlinked\n",
                    fm->path);
-            ctx->already_saved += fm->size;
+            // every block of a hardlinked file is shared
+            counter_add(counters, COUNTER_ALREADY_SAVED, allocated_size(fm->path));
             continue;
-        }
-
-        if ((ctx->replace_mode == DEDUP_CLONE && fm->clone_id == origin->clone_id) ||
-            (ctx->replace_mode == DEDUP_LINK && fm->inode == origin->inode)) {
+        case SKIP_CLONED:
             printf("\tskipping %s, already cloned\n",
                    fm->path);
-            ctx->already_saved += fm->size;
+            counter_add(counters,
+                        COUNTER_ALREADY_SAVED,
+                        ctx->replace_mode == DEDUP_LINK
+                            ? allocated_size(fm->path)
+                            : shared_size(fm->path));
             continue;
-        }
-
-        if (fm->flags & UF_IMMUTABLE ||
-            fm->flags & SF_IMMUTABLE) {
+        case SKIP_IMMUTABLE:
             printf("\tskipping %s, immutable\n",
                    fm->path);
             continue;
+        case SKIP_NONE:
+            break;
         }
 
         if (ctx->dry_run) {
             printf("\tcloning to %s\n",
                    fm->path);
-            ctx->saved += fm->size;
+            counter_add(counters,
+                        COUNTER_SAVED,
+                        fm->nlink > 1 ? 0 : private_size(fm->path));
             continue;
         }
 
-        int result = 0;
-        switch (ctx->replace_mode) {
-        case DEDUP_CLONE:
-            result = replace_with_clone(origin->path,
-                                        fm->path,
-                                        ctx->preserve_parent_mtime);
-            break;
-        case DEDUP_LINK:
-            result = replace_with_link(origin->path,
-                                       fm->path);
-            break;
-        case DEDUP_SYMLINK:
-            result = replace_with_symlink(origin->path,
-                                          fm->path);
-            break;
-        }
-
-        if (result) {
+        if (r->result) {
+            errno = r->error;
             perror("clone failed");
             fprintf(stderr,
                     "\tcould not clone %s\n",
                     fm->path);
+            r++;
             continue;
         }
 
         printf("\tcloned to %s\n",
                fm->path);
 
-        if (ctx->replace_mode == DEDUP_CLONE && origin_clone_id != get_clone_id(fm->path)) {
+        if (!r->cloned) {
             if (private_size(fm->path) == 0) {
                 fprintf(stderr,
                         "\t\tclonefile(2) did not clone %s as expected, but it is a clone\n",
                         fm->path);
-                ctx->already_saved += fm->size;
-                continue;
+                counter_add(counters, COUNTER_ALREADY_SAVED, shared_size(fm->path));
             } else {
                 fprintf(stderr,
                         "\t\tclonefile(2) did not clone %s as expected, did not report an error\n",
                         fm->path);
-                continue;
             }
+            r++;
+            continue;
         }
 
-        ctx->saved += fm->size;
+        counter_add(counters, COUNTER_SAVED, r->freeable);
+        r++;
     }
 
+    free(batch.replacements);
     return 0;
 }
 
@@ -390,17 +1101,45 @@ static void usage(char* pgm, DedupContext* ctx) {
                 // "  --color, -c              Enabled colored output.\n"
                 "  --no-progress, -P        Do not display a progress bar.\n"
                 "  --threads, -t n          The number of threads to use for file building\n"
-                "                           lookup tables and replacing clones. Default: %d\n"
+                "                           lookup tables and replacing clones, for each\n"
+                "                           device. Default: %d\n"
                 "  --parent-mtime, -m       Preserve the mtime of any parent directory\n"
                 "                           modified with a clone.\n"
                 "  --verbose, -v            Increase verbosity. May be used multiple times.\n"
+                "  --stats[=format]         Print time spent and syscalls made in each stage\n"
+                "                           to stderr on exit. format is text (default) or\n"
+                "                           json.\n"
+                "  --trace=file             Write a Chrome trace of what each thread was\n"
+                "                           doing to file.\n"
+                "  --simulate=spec          Scan a generated in-memory tree instead of the\n"
+                "                           filesystem. spec is files=n[,seed=n]\n"
+                "                           [,size=min[:max]][,dup=%%][,clones=%%]\n"
+                "                           [,latency=us][,throughput=mb]\n"
+                "                           [,rotational=0|1][,devices=n].\n"
+                "  --record-trace=file      Record the metadata, probes, and digests\n"
+                "                           gathered during the scan to file.\n"
+                "  --replay=file            Evaluate a recording made with --record-trace\n"
+                "                           instead of the filesystem. Implies --dry-run.\n"
+                "  --defragment=n           When no file in a set of duplicates is stored in\n"
+                "                           n or fewer fragments, rewrite the clone origin\n"
+                "                           contiguously before cloning it.\n"
+                "  --compare-limit=n        Compare files of the same size byte by byte\n"
+                "                           instead of hashing them while there are at\n"
+                "                           most n distinct ones. 0 always hashes.\n"
+                "                           Default: %d\n"
+                "  --probe-threads=n        Probe files on n threads of their own for each\n"
+                "                           device and leave the other threads to compare\n"
+                "                           them. Useful where each open or read is a\n"
+                "                           network round trip. Ignored with -t 0.\n"
+                "                           Default: 0\n"
                 "  --version, -V            Print the version and exit\n"
                 // "  --force, -f              Don't preserve existing hardlinks.\n"
                 "  -h                       Human readable output.\n"
                 "  --help                   Show this help.\n",
             version,
             pgm,
-            ctx->thread_count);
+            ctx->thread_count,
+            VISITED_COMPARE_MAX);
 
     exit(1);
 }
@@ -413,58 +1152,15 @@ int32_t cpu_count() {
     return c;
 }
 
-__attribute__((const))
-bool is_vol_cap_supported(char* path, int vol_cap) {
-    struct VolAttrsBuf {
-        u_int32_t length;
-        vol_capabilities_attr_t capabilities;
-        vol_attributes_attr_t attributes;
-    } __attribute__((aligned(4), packed));
-    struct VolAttrsBuf vol_attrs;
-
-    struct attrlist attr_list = {
-        .bitmapcount = ATTR_BIT_MAP_COUNT,
-        .volattr = ATTR_VOL_INFO | ATTR_VOL_CAPABILITIES | ATTR_VOL_ATTRIBUTES,
-    };
-    // get the file system's mount point path for the input path
-    struct statfs stat_buf;
-    int result = statfs(path, &stat_buf);
-
-    if (result) {
-        perror("Could not get volume stat");
-        // TODO: exit?
-        return false;
+static bool walk_next(VfsWalk* traversal, VfsEntry* entry) {
+    StatsSpan walk = stats_begin(STATS_WALK);
+    bool found = vfs->walk_next(traversal, entry);
+    if (found) {
+        // fts(3) stats each entry it returns
+        stats_syscall(STATS_SYSCALL_STAT);
     }
-
-    // get the supported capabilities and attributes
-    result = getattrlist(stat_buf.f_mntonname,
-                         &attr_list,
-                         &vol_attrs,
-                         sizeof(vol_attrs),
-                         FSOPT_ATTR_CMN_EXTENDED);
-    if (result) {
-        perror("Could not retrieve volume attributes");
-        // TODO: exit?
-        return false;
-    }
-
-     #define VOL_CAPABILITIES_FORMAT     0
-     #define VOL_CAPABILITIES_INTERFACES 1
-     #define VOL_CAPABILITIES_RESERVED1  2
-     #define VOL_CAPABILITIES_RESERVED2  3
-
-    return vol_attrs.capabilities.capabilities[VOL_CAPABILITIES_INTERFACES] & vol_cap;
-}
-
-__attribute__((const))
-bool is_clonefile_supported(char* path) {
-    return is_vol_cap_supported(path, VOL_CAP_INT_CLONE);
-}
-
-__attribute__((unused))
-__attribute__((const))
-bool are_acls_supported(char* path) {
-    return is_vol_cap_supported(path, VOL_CAP_INT_RENAME_SWAP);
+    stats_end(&walk);
+    return found;
 }
 
 void print_human_bytes(uint64_t bytes) {
@@ -491,34 +1187,40 @@ void print_human_bytes(uint64_t bytes) {
     printf("%0.f%s", v, unit);
 }
 
+// long options without a short equivalent
+enum {
+    OPTION_STATS = 0x100,
+    OPTION_TRACE,
+    OPTION_SIMULATE,
+    OPTION_RECORD,
+    OPTION_REPLAY,
+    OPTION_DEFRAGMENT,
+    OPTION_COMPARE_LIMIT,
+    OPTION_PROBE_THREADS,
+};
+
 int main(int argc, char* argv[]) {
 
-    FileEntryHead* queue = new_file_entry_queue();
     Progress p = { 0 };
     uint16_t max_depth = UINT16_MAX;
     int user_fts_options = 0;
+    StatsFormat stats_format = STATS_FORMAT_NONE;
+    char* trace_path = NULL;
+    char* record_path = NULL;
 
     DedupContext dc = {
         .progress = &p,
-        .queue = queue,
-        .visited = new_visited_tree(),
         .duplicates = new_duplicate_tree(),
-        .found = 0,
-        .saved = 0,
-        .already_saved = 0,
-        .done = 0,
         .dry_run = false,
         .verbosity = 0,
         .force = false,
         .preserve_parent_mtime = false,
         .replace_mode = DEDUP_CLONE,
+        .defragment = 0,
         .thread_count = cpu_count(),
-        .metrics_mutex = PTHREAD_MUTEX_INITIALIZER,
+        .probe_threads = 0,
         .progress_mutex = PTHREAD_MUTEX_INITIALIZER,
-        .queue_mutex = PTHREAD_MUTEX_INITIALIZER,
-        .visited_mutex = PTHREAD_MUTEX_INITIALIZER,
         .duplicates_mutex = PTHREAD_MUTEX_INITIALIZER,
-        .done_mutex = PTHREAD_MUTEX_INITIALIZER,
     };
 
     static const struct option options[] = {
@@ -534,6 +1236,14 @@ int main(int argc, char* argv[]) {
         { "threads",         required_argument, NULL, 't' },
         { "verbose",         no_argument,       NULL, 'v' },
         { "one-file-system", no_argument,       NULL, 'x' },
+        { "stats",           optional_argument, NULL, OPTION_STATS },
+        { "trace",           required_argument, NULL, OPTION_TRACE },
+        { "simulate",        required_argument, NULL, OPTION_SIMULATE },
+        { "record-trace",    required_argument, NULL, OPTION_RECORD },
+        { "replay",          required_argument, NULL, OPTION_REPLAY },
+        { "defragment",      required_argument, NULL, OPTION_DEFRAGMENT },
+        { "compare-limit",   required_argument, NULL, OPTION_COMPARE_LIMIT },
+        { "probe-threads",   required_argument, NULL, OPTION_PROBE_THREADS },
         // { "force",           no_argument,       NULL, 'f' },
         { "help",            no_argument,       NULL, '?' },
         { NULL, 0, NULL, 0 },
@@ -597,6 +1307,69 @@ int main(int argc, char* argv[]) {
             case 'x':
                 user_fts_options |= FTS_XDEV;
                 break;
+            case OPTION_STATS:
+                if (!optarg || strcmp(optarg, "text") == 0) {
+                    stats_format = STATS_FORMAT_TEXT;
+                } else if (strcmp(optarg, "json") == 0) {
+                    stats_format = STATS_FORMAT_JSON;
+                } else {
+                    fprintf(stderr, "Unknown stats format: %s\n", optarg);
+                    usage(argv[0], &dc);
+                }
+                break;
+            case OPTION_TRACE:
+                trace_path = optarg;
+                break;
+            case OPTION_SIMULATE:
+                vfs = vfs_memory(optarg);
+                if (!vfs) {
+                    fprintf(stderr, "Invalid simulation: %s\n", optarg);
+                    usage(argv[0], &dc);
+                }
+                break;
+            case OPTION_RECORD:
+                record_path = optarg;
+                break;
+            case OPTION_REPLAY:
+                vfs = vfs_replay(optarg);
+                if (!vfs) {
+                    err(1, "Could not replay %s", optarg);
+                }
+                // recordings are read-only
+                dc.dry_run = true;
+                break;
+            case OPTION_DEFRAGMENT:
+                t = atoi(optarg);
+                if (t < 1) {
+                    fprintf(stderr,
+                            "Fragment threshold must be at least 1: %s\n",
+                            optarg);
+                    usage(argv[0], &dc);
+                }
+                dc.defragment = t;
+                break;
+            case OPTION_COMPARE_LIMIT:
+                t = atoi(optarg);
+                if (t < 0 || t > VISITED_COMPARE_MAX) {
+                    fprintf(stderr,
+                            "Compare limit must be between 0 and %d: %s\n",
+                            VISITED_COMPARE_MAX,
+                            optarg);
+                    usage(argv[0], &dc);
+                }
+                visited_compare_limit = t;
+                break;
+            case OPTION_PROBE_THREADS:
+                t = atoi(optarg);
+                if (t < 0 || t > PROBE_THREADS_MAX) {
+                    fprintf(stderr,
+                            "Probe thread count must be between 0 and %d: %s\n",
+                            PROBE_THREADS_MAX,
+                            optarg);
+                    usage(argv[0], &dc);
+                }
+                dc.probe_threads = t;
+                break;
             case '?':
             default:
                 usage(argv[0], &dc);
@@ -619,16 +1392,32 @@ int main(int argc, char* argv[]) {
         : (char**) DEFAULT_PATHS;
 
     for (int i = 0; i < argc; i++) {
-        if (access(argv[i], F_OK) < 0) {
+        if (vfs->access(argv[i], F_OK) < 0) {
             fprintf(stderr, "cannot open %s\n", argv[i]);
             perror("access(2)");
             return 1;
         }
     }
 
-    FTS* traversal = fts_open(paths,
-                              FTS_NOCHDIR | FTS_PHYSICAL | user_fts_options,
-                              NULL);
+    if (stats_format != STATS_FORMAT_NONE) {
+        stats_enable();
+    }
+
+    if (trace_path) {
+        if (trace_open(trace_path)) {
+            err(1, "Could not open trace file %s", trace_path);
+        }
+        trace_thread_name("main");
+    }
+
+    if (record_path &&
+        record_open(record_path, vfs->extent_clone_ids ? RECORD_EXTENT_CLONE_IDS : 0)) {
+        err(1, "Could not open recording %s", record_path);
+    }
+    uint64_t traversal_started = stats_now();
+
+    VfsWalk* traversal = vfs->walk_open(paths,
+                                        FTS_NOCHDIR | FTS_PHYSICAL | user_fts_options);
 
     // n.b! as of Libc-1244.1.7 fts_open will only fail if it cannot
     //      allocate memory. this makes this check extremely unlikely
@@ -641,51 +1430,67 @@ int main(int argc, char* argv[]) {
     }
     // LCOV_EXCL_STOP
 
-    pthread_t* threads = calloc(dc.thread_count, sizeof(pthread_t));
-    for (int i = 0; i < dc.thread_count; i++) {
-        int r = pthread_create(&threads[i], NULL, dedup_work, &dc);
-        if (r) {
-            warn("Could not create threads: error %i\nRunning single threaded.",
-                 r);
-            dc.thread_count = i;
-            break;
-        }
+    // one shard for the main thread and one for each worker of each pool
+    dc.counters = new_counters((DEVICE_POOLS_MAX + 1) * dc.thread_count + 1);
+    CounterShard* main_counters = counters_shard(dc.counters, 0);
+    p.counters = dc.counters;
+
+    if (dc.progress && start_progress(dc.progress, &dc.progress_mutex)) {
+        warnx("Could not start progress display");
+        dc.progress = NULL;
     }
 
+    DedupWorker main_worker = {
+        .context = &dc,
+        .counters = main_counters,
+        .main_thread = true,
+    };
+
     dev_t current_dev = -1;
     bool clonefile_supported = false;
-    FTSENT* entry = NULL;
-    while ((entry = fts_read(traversal)) != NULL) {
-        if (entry->fts_errno) {
-            char* e = strerror(entry->fts_errno);
+    bool rotational = false;
+    DevicePool* pool = NULL;
+    VfsEntry e = { 0 };
+    VfsEntry* entry = &e;
+    while (walk_next(traversal, entry)) {
+        if (entry->error) {
+            char* message = strerror(entry->error);
             PROGRESS_LOCK(dc.progress, &dc.progress_mutex, {
                 clear_progress();
                 warnx("%s: error (%d): %s",
-                      entry->fts_path,
-                      entry->fts_errno,
-                      e);
-                display_progress(dc.progress);
+                      entry->path,
+                      entry->error,
+                      message);
             });
             continue;
         }
 
-        if (entry->fts_level > (max_depth + 1)) {
-            fts_set(traversal, entry, FTS_SKIP);
+        if (entry->level > (max_depth + 1)) {
+            vfs->walk_skip(traversal);
             continue;
         }
 
-        if (dc.replace_mode == DEDUP_CLONE &&
-            current_dev != entry->fts_statp->st_dev) {
-            current_dev = entry->fts_statp->st_dev;
-            clonefile_supported = is_clonefile_supported(entry->fts_path);
+        if (current_dev != entry->device) {
+            current_dev = entry->device;
+            rotational = vfs->rotational(entry->path);
+            if (rotational && dc.verbosity) {
+                PROGRESS_LOCK(dc.progress, &dc.progress_mutex, {
+                    clear_progress();
+                    printf("%s is on a rotational disk, reading its files in physical order\n",
+                           entry->path);
+                });
+            }
+
+            clonefile_supported = dc.replace_mode == DEDUP_CLONE &&
+                vfs->clone_supported(entry->path);
 
-            if (!clonefile_supported) {
-                warnx("Skipping %s: cloning not supported", entry->fts_path);
+            if (dc.replace_mode == DEDUP_CLONE && !clonefile_supported) {
+                warnx("Skipping %s: cloning not supported", entry->path);
 
                 // if FTS_XDEV is set, we can't accidentally cross into a
                 // volume that does support clonefile, so skip everything else
                 if (user_fts_options & FTS_XDEV) {
-                    fts_set(traversal, entry, FTS_SKIP);
+                    vfs->walk_skip(traversal);
                     continue;
                 }
             }
@@ -697,104 +1502,158 @@ int main(int argc, char* argv[]) {
         }
 
         // the file cannot be a directory
-        if (entry->fts_info == FTS_D ||
-            entry->fts_info == FTS_DC ||
-            entry->fts_info == FTS_DNR ||
-            entry->fts_info == FTS_DOT ||
-            entry->fts_info == FTS_DP) {
+        if (entry->info == FTS_D ||
+            entry->info == FTS_DC ||
+            entry->info == FTS_DNR ||
+            entry->info == FTS_DOT ||
+            entry->info == FTS_DP) {
             continue;
         }
 
         // make sure named pipes (fifo), character special,
         // block special, symlinks, whiteout, etc.
-        if (entry->fts_info != FTS_F) {
+        if (entry->info != FTS_F) {
             continue;
         }
 
         // the file cannot be empty
-        if (entry->fts_statp->st_size == 0) {
+        if (entry->size == 0) {
             continue;
         }
 
         // the file looks like a previously failed clone
-        if (strnlen(entry->fts_path, PATH_MAX) > 3 &&
-            entry->fts_path[0] == '.' &&
-            entry->fts_path[1] == '~' &&
-            entry->fts_path[2] == '.') {
+        if (strnlen(entry->path, PATH_MAX) > 3 &&
+            entry->path[0] == '.' &&
+            entry->path[1] == '~' &&
+            entry->path[2] == '.') {
             continue;
         }
 
         // at this point we have a regular file
         // that only has one link
-        PROGRESS_LOCK(dc.progress, &dc.progress_mutex, {
-            dc.progress->totalUnitCount++;
-            display_progress(dc.progress);
+        counter_add(main_counters, COUNTER_TOTAL_UNITS, 1);
+        counter_add(main_counters, COUNTER_TOTAL_BYTES, entry->size);
+
+        if (record_enabled) {
+            record_entry(entry->path,
+                         entry->device,
+                         entry->inode,
+                         entry->nlink,
+                         entry->flags,
+                         entry->size,
+                         entry->level);
+        }
+
+        if (!pool || pool->device != entry->device) {
+            pool = device_pool(&dc, entry->device, rotational);
+            if (!pool) {
+                err(1, "Could not start threads for the device of %s", entry->path);
+            }
+        }
+
+        STATS_LOCKED(&pool->queue_mutex, "queue_mutex", {
+            file_entry_queue_append(pool->queue,
+                                    entry->path,
+                                    entry->device,
+                                    entry->inode,
+                                    entry->nlink,
+                                    entry->flags,
+                                    entry->size,
+                                    entry->level);
         });
 
-        pthread_mutex_lock(&dc.queue_mutex);
-        file_entry_queue_append(queue,
-                                entry->fts_path,
-                                entry->fts_statp->st_dev,
-                                entry->fts_statp->st_ino,
-                                entry->fts_statp->st_nlink,
-                                entry->fts_statp->st_flags,
-                                entry->fts_statp->st_size,
-                                entry->fts_level);
-        pthread_mutex_unlock(&dc.queue_mutex);
+        if (pool->probe_threads) {
+            pthread_cond_signal(&pool->queue_ready);
+        }
 
-        if (dc.thread_count == 0) {
-            dedup_work(&dc);
+        if (pool->thread_count == 0) {
+            main_worker.pool = pool;
+            dedup_work(&main_worker);
         }
     }
 
-    fts_close(traversal);
+    vfs->walk_close(traversal);
 
-    pthread_mutex_lock(&dc.done_mutex);
-    dc.done = 1;
-    pthread_mutex_unlock(&dc.done_mutex);
+    if (trace_enabled) {
+        trace_event("traversal", traversal_started, stats_now() - traversal_started, -1);
+    }
 
-    for (int i = 0; i < dc.thread_count; i++) {
-        // clang-analyzer thinks threads[i] can be NULL, but `pthread_t`
-        // is an opaque type (to us). if `pthread_create` is successful
-        // the API contract says we can pass that value to pthread_join.
-        // the assertion is less intrusive than suppressing the warning
-        // by checking for the _clang_analyzer macro
-        assert(threads[i] != NULL);
-        if (pthread_join(threads[i], NULL)) {
-            fprintf(stderr, "Failed to wait for thread %i\n", i);
+    // pools drain in parallel, so waiting for them in turn costs nothing
+    for (size_t i = 0; i < dc.pool_count; i++) {
+        finish_device_pool(dc.pools[i]);
+
+        // without workers, entries held back until the walk was done are
+        // visited now
+        if (dc.pools[i]->thread_count == 0) {
+            main_worker.pool = dc.pools[i];
+            dedup_work(&main_worker);
         }
     }
-    free(threads); threads = NULL;
+    hash_pool_stop();
 
-    free_file_entry_queue(queue); queue = NULL;
-    free_visited_tree(dc.visited); dc.visited = NULL;
+    for (size_t i = 0; i < dc.pool_count; i++) {
+        duplicate_tree_merge_identities(dc.duplicates, dc.pools[i]->visited);
+        free_device_pool(dc.pools[i]); dc.pools[i] = NULL;
+    }
 
     if (dc.progress) {
-        clear_progress();
+        stop_progress(dc.progress);
     }
-    printf("duplicates found: %zu\n", dc.found);
+    printf("duplicates found: %llu\n",
+           (unsigned long long) counters_sum(dc.counters, COUNTER_FOUND));
 
+    // sets are keyed by digests, or by keys derived from whichever file
+    // happened to be visited first, so they are deduplicated in the order of
+    // their first file instead
+    AList* duplicate_sets = new_alist();
     SHA256ListNode* duplicate_set = NULL;
     RB_TREE_FOREACH(duplicate_set, dc.duplicates) {
-        deduplicate(duplicate_set->list, &dc);
+        alist_sort(duplicate_set->list, compare_metadata_elements);
+        alist_add(duplicate_sets, duplicate_set->list);
+    }
+    alist_sort(duplicate_sets, compare_sets);
+
+    // up to `thread_count` files of a set are replaced at once, by threads
+    // started once for every set
+    if (!dc.dry_run && !dc.preserve_parent_mtime && dc.thread_count > 1) {
+        dc.apply_pool = start_apply_pool(dc.thread_count - 1);
+    }
+
+    for (size_t i = 0; i < alist_size(duplicate_sets); i++) {
+        AList* set = alist_get(duplicate_sets, i);
+        StatsSpan group = stats_begin(STATS_DEDUPLICATE);
+        group.size = ((FileMetadata*) alist_get(set, 0))->size;
+        deduplicate(set, &dc);
+        stats_end(&group);
+    }
+    free_alist(duplicate_sets); duplicate_sets = NULL;
+    if (dc.apply_pool) {
+        stop_apply_pool(dc.apply_pool); dc.apply_pool = NULL;
     }
 
     printf("bytes saved: ");
     if (human_readable) {
-        print_human_bytes(dc.saved);
+        print_human_bytes(counters_sum(dc.counters, COUNTER_SAVED));
     } else {
-        printf("%zu", dc.saved);
+        printf("%llu", (unsigned long long) counters_sum(dc.counters, COUNTER_SAVED));
     }
     putchar('\n');
 
     printf("already saved: ");
     if (human_readable) {
-        print_human_bytes(dc.already_saved);
+        print_human_bytes(counters_sum(dc.counters, COUNTER_ALREADY_SAVED));
     } else {
-        printf("%zu", dc.already_saved);
+        printf("%llu", (unsigned long long) counters_sum(dc.counters, COUNTER_ALREADY_SAVED));
     }
     putchar('\n');
 
+    trace_close();
+    if (record_close()) {
+        warn("Could not write recording %s", record_path);
+    }
+    stats_report(stderr, stats_format);
+
     free_duplicate_tree(dc.duplicates); dc.duplicates = NULL;
+    free_counters(dc.counters); dc.counters = NULL;
     return 0;
 }
@@ -26,17 +26,32 @@
 
 #include "map.h"
 
-#include <sys/mman.h>
-
 #include <CommonCrypto/CommonDigest.h>
-#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "probes.h"
+#include "record.h"
+#include "stats.h"
+#include "utils.h"
+#include "vfs.h"
+
 static const char EMPTY_SHA256[32] =  { 0 };
 
+size_t visited_compare_limit = VISITED_COMPARE_MAX;
+
+// bytes read from each file per step of a lockstep comparison
+#define COMPARE_WINDOW_SIZE (256 * 1024)
+
+// bytes hashed per step, and how many steps ahead of the one being hashed
+// reads are started with `Vfs.advise`
+#define HASH_WINDOW_SIZE (1024 * 1024)
+#define READ_AHEAD_WINDOWS 8
+
 void free_metadata(FileMetadata* fm) {
     free(fm->path);
     free(fm);
@@ -60,6 +75,16 @@ FileMetadata* metadata_dup(FileMetadata* fm) {
             ? 1           \
             : 0))
 
+int metadata_compare(const FileMetadata* a, const FileMetadata* b) {
+    if (a->device != b->device) {
+        return COMPARE_INT(a->device, b->device);
+    }
+    if (a->inode != b->inode) {
+        return COMPARE_INT(a->inode, b->inode);
+    }
+    return strcmp(a->path, b->path);
+}
+
 signed int compare_device_node(void *context, const void *node1, const void *node2) {
     const DeviceNode* a = node1, * b = node2;
     return COMPARE_INT(a->d, b->d);
@@ -134,6 +159,9 @@ static const rb_tree_ops_t SHA256_OPS = {
 
 rb_tree_t* new_visited_tree() {
     rb_tree_t* t = malloc(sizeof(rb_tree_t));
+    if (!t) {
+        return NULL;
+    }
     rb_tree_init(t, &DEVICE_OPS);
 
     return t;
@@ -145,9 +173,12 @@ void free_metadata_node(FileMetadataNode* fm_node) {
 }
 
 void free_last_node(CharNode* last_node) {
-    if (last_node->fm) {
-        free_metadata(last_node->fm);
-        last_node->fm = NULL;
+    if (last_node->pending) {
+        for (size_t i = 0; i < alist_size(last_node->pending); i++) {
+            free_metadata(alist_get(last_node->pending, i));
+        }
+        free_alist(last_node->pending);
+        last_node->pending = NULL;
     }
 
     FileMetadataNode* fm_node = NULL;
@@ -157,6 +188,7 @@ void free_last_node(CharNode* last_node) {
         free_metadata_node(fm_node);
         fm_node = NULL;
     }
+    pthread_mutex_destroy(&last_node->mutex);
     free(last_node); last_node = NULL;
 }
 
@@ -234,6 +266,7 @@ CharNode* visited_tree_find_or_create_last_node(rb_tree_t* tree, FileMetadata* f
     if (!last_node) {
         last_node = calloc(1, sizeof(CharNode));
         last_node->c = fm->last;
+        pthread_mutex_init(&last_node->mutex, NULL);
 
         rb_tree_init(&last_node->children, &SHA256_OPS);
         rb_tree_insert_node(last_tree, last_node);
@@ -244,107 +277,538 @@ CharNode* visited_tree_find_or_create_last_node(rb_tree_t* tree, FileMetadata* f
 #define SHA_IS_EMPTY(sha) \
     (memcmp((sha), EMPTY_SHA256, 32) == 0)
 
-int populate_sha256_if_empty(FileMetadata* fm) {
-    // if populated, return
-    if (!SHA_IS_EMPTY(fm->sha256)) {
-        return 0;
+typedef struct ChunkedHash {
+    int fd;
+    const uint8_t* buffer;
+    size_t size;
+    size_t chunks;
+    // chunks handed out and chunks hashed, guarded by `hash_pool_mutex`
+    size_t next;
+    size_t hashed;
+    uint8_t (*digests)[32];
+    // signalled when the last chunk is hashed
+    pthread_cond_t finished;
+    struct ChunkedHash* queued;
+} ChunkedHash;
+
+static pthread_mutex_t hash_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+// signalled when a file is queued or the pool is stopped
+static pthread_cond_t hash_pool_ready = PTHREAD_COND_INITIALIZER;
+// files with chunks that have not been handed out yet
+static ChunkedHash* hash_queue = NULL;
+static pthread_t* hash_pool_threads = NULL;
+static unsigned hash_pool_size = 0;
+static bool hash_pool_stopping = false;
+
+// hands out the next chunk of `h`, and takes `h` off the queue once every
+// chunk has been. must be called with `hash_pool_mutex` held.
+static bool take_chunk(ChunkedHash* h, size_t* i) {
+    if (h->next == h->chunks) {
+        return false;
+    }
+    *i = h->next++;
+    if (h->next == h->chunks) {
+        ChunkedHash** link = &hash_queue;
+        while (*link && *link != h) {
+            link = &(*link)->queued;
+        }
+        if (*link) {
+            *link = h->queued;
+        }
+    }
+    return true;
+}
+
+static void hash_chunk(ChunkedHash* h, size_t i) {
+    size_t offset = i * HASH_CHUNK_SIZE,
+           length = h->size - offset < HASH_CHUNK_SIZE ? h->size - offset : HASH_CHUNK_SIZE;
+    // the whole chunk is requested at once, so every thread has reads
+    // outstanding rather than one page fault at a time
+    if (vfs->advise) {
+        vfs->advise(h->fd, offset, length);
+    }
+    CC_SHA256(h->buffer + offset, length, h->digests[i]);
+
+    pthread_mutex_lock(&hash_pool_mutex);
+    if (++h->hashed == h->chunks) {
+        pthread_cond_signal(&h->finished);
+    }
+    pthread_mutex_unlock(&hash_pool_mutex);
+}
+
+static void* hash_pool_work(void* context) {
+    pthread_mutex_lock(&hash_pool_mutex);
+    while (true) {
+        while (!hash_queue && !hash_pool_stopping) {
+            pthread_cond_wait(&hash_pool_ready, &hash_pool_mutex);
+        }
+        ChunkedHash* h = hash_queue;
+        size_t i = 0;
+        if (!h || !take_chunk(h, &i)) {
+            break;
+        }
+        pthread_mutex_unlock(&hash_pool_mutex);
+        hash_chunk(h, i);
+        pthread_mutex_lock(&hash_pool_mutex);
+    }
+    pthread_mutex_unlock(&hash_pool_mutex);
+    return NULL;
+}
+
+unsigned hash_pool_add(unsigned count) {
+    pthread_mutex_lock(&hash_pool_mutex);
+    pthread_t* threads = realloc(hash_pool_threads, (hash_pool_size + count) * sizeof(pthread_t));
+    unsigned started = 0;
+    if (threads) {
+        hash_pool_threads = threads;
+        for (; started < count; started++) {
+            if (pthread_create(&threads[hash_pool_size], NULL, hash_pool_work, NULL)) {
+                break;
+            }
+            hash_pool_size++;
+        }
+    }
+    pthread_mutex_unlock(&hash_pool_mutex);
+    return started;
+}
+
+void hash_pool_stop() {
+    pthread_mutex_lock(&hash_pool_mutex);
+    hash_pool_stopping = true;
+    pthread_cond_broadcast(&hash_pool_ready);
+    pthread_mutex_unlock(&hash_pool_mutex);
+
+    for (unsigned i = 0; i < hash_pool_size; i++) {
+        pthread_join(hash_pool_threads[i], NULL);
+    }
+    free(hash_pool_threads);
+    hash_pool_threads = NULL;
+    hash_pool_size = 0;
+    hash_pool_stopping = false;
+}
+
+// the digest of the digests of each `HASH_CHUNK_SIZE` chunk of `buffer`.
+// chunks are hashed by this thread and any threads of the hash pool that
+// are not busy with the chunks of other files.
+static int chunked_sha256(int fd, const uint8_t* buffer, size_t size, uint8_t sha256[32]) {
+    ChunkedHash h = {
+        .fd = fd,
+        .buffer = buffer,
+        .size = size,
+        .chunks = (size + HASH_CHUNK_SIZE - 1) / HASH_CHUNK_SIZE,
+        .finished = PTHREAD_COND_INITIALIZER,
+    };
+    h.digests = malloc(h.chunks * sizeof(*h.digests));
+    if (!h.digests) {
+        return 1;
+    }
+
+    pthread_mutex_lock(&hash_pool_mutex);
+    if (hash_pool_size) {
+        h.queued = hash_queue;
+        hash_queue = &h;
+        pthread_cond_broadcast(&hash_pool_ready);
+    }
+    size_t i = 0;
+    while (take_chunk(&h, &i)) {
+        pthread_mutex_unlock(&hash_pool_mutex);
+        hash_chunk(&h, i);
+        pthread_mutex_lock(&hash_pool_mutex);
     }
+    // the last chunks may still be hashed by other threads
+    while (h.hashed < h.chunks) {
+        pthread_cond_wait(&h.finished, &hash_pool_mutex);
+    }
+    pthread_mutex_unlock(&hash_pool_mutex);
+    pthread_cond_destroy(&h.finished);
+
+    CC_SHA256(h.digests, h.chunks * sizeof(*h.digests), sha256);
+    free(h.digests);
+    return 0;
+}
 
-    int fd = open(fm->path, O_RDONLY);
+static int compute_sha256(FileMetadata* fm) {
+    stats_syscall(STATS_SYSCALL_OPEN);
+    int fd = vfs->open(fm->path);
     if (fd < 0) {
         fprintf(stderr, "failed to mmap %s\n", fm->path);
         perror("open");
         return 2;
     }
 
-    char* buffer = mmap((caddr_t) 0,
-                        fm->size,
-                        PROT_READ,
-                        MAP_PRIVATE,
-                        fd,
-                        0);
-    if (buffer == MAP_FAILED) {
+    if (vfs->digest) {
+        int r = vfs->digest(fd, fm->size, fm->sha256);
+        if (r) {
+            fprintf(stderr, "failed to get the digest of %s\n", fm->path);
+            perror("digest");
+        }
+        vfs->close(fd);
+        return r ? 2 : 0;
+    }
+
+    stats_syscall(STATS_SYSCALL_MMAP);
+    char* buffer = vfs->map(fd, fm->size);
+    if (!buffer) {
         fprintf(stderr, "failed to mmap %s\n", fm->path);
         perror("mmap");
+        vfs->close(fd);
         return 2;
     }
 
+    if (fm->size >= CHUNKED_HASH_SIZE) {
+        int r = chunked_sha256(fd, (const uint8_t*) buffer, fm->size, fm->sha256);
+        vfs->unmap(buffer, fm->size);
+        vfs->close(fd);
+        stats_read(fm->size);
+        if (r) {
+            fprintf(stderr, "could not hash %s\n", fm->path);
+            return 3;
+        }
+        return 0;
+    }
+
     //
     // calculate SHA-256
     //
 
+    if (vfs->advise) {
+        size_t ahead = READ_AHEAD_WINDOWS * HASH_WINDOW_SIZE;
+        vfs->advise(fd, 0, fm->size < ahead ? fm->size : ahead);
+    }
+
     CC_SHA256_CTX c = { 0 };
     CC_SHA256_Init(&c);
-    int err = CC_SHA256_Update(&c, buffer, fm->size);
-    if (err != 1) {
-        fprintf(stderr, "error: %d\n", err);
-        perror("CC_SHA256_Update");
-        return 3;
+    for (size_t offset = 0; offset < fm->size; offset += HASH_WINDOW_SIZE) {
+        size_t window = fm->size - offset < HASH_WINDOW_SIZE
+            ? fm->size - offset
+            : HASH_WINDOW_SIZE;
+
+        // keep the next few windows in flight while this one is hashed
+        size_t ahead = offset + READ_AHEAD_WINDOWS * HASH_WINDOW_SIZE;
+        if (vfs->advise && ahead < fm->size) {
+            vfs->advise(fd, ahead, HASH_WINDOW_SIZE);
+        }
+
+        int err = CC_SHA256_Update(&c, buffer + offset, window);
+        if (err != 1) {
+            fprintf(stderr, "error: %d\n", err);
+            perror("CC_SHA256_Update");
+            vfs->unmap(buffer, fm->size);
+            vfs->close(fd);
+            return 3;
+        }
     }
 
-    munmap(buffer, fm->size);
-    close(fd);
+    vfs->unmap(buffer, fm->size);
+    vfs->close(fd);
+    stats_read(fm->size);
 
     int r = CC_SHA256_Final(fm->sha256, &c);
     return !r;
 }
 
-FileMetadata* visited_tree_insert(rb_tree_t* tree, FileMetadata* fm) {
-    CharNode* last_node = visited_tree_find_or_create_last_node(tree, fm);
+int populate_sha256_if_empty(FileMetadata* fm) {
+    // if populated, return
+    if (!SHA_IS_EMPTY(fm->sha256)) {
+        return 0;
+    }
+
+    uint64_t started = DEDUP_HASH_ENABLED() ? stats_now() : 0;
+    StatsSpan span = stats_begin(STATS_HASH);
+    span.size = fm->size;
+    int r = compute_sha256(fm);
+    stats_end(&span);
+
+    if (DEDUP_HASH_ENABLED()) {
+        DEDUP_HASH(fm->path, fm->size, stats_now() - started);
+    }
+
+    if (!r && record_enabled) {
+        record_digest(fm->device, fm->inode, fm->sha256);
+    }
+    return r;
+}
+
+void populate_sha256_from_buffer(FileMetadata* fm, const void* buffer) {
+    uint64_t started = DEDUP_HASH_ENABLED() ? stats_now() : 0;
+    StatsSpan span = stats_begin(STATS_HASH);
+    span.size = fm->size;
+    CC_SHA256(buffer, fm->size, fm->sha256);
+    stats_end(&span);
+
+    if (DEDUP_HASH_ENABLED()) {
+        DEDUP_HASH(fm->path, fm->size, stats_now() - started);
+    }
+
+    if (record_enabled) {
+        record_digest(fm->device, fm->inode, fm->sha256);
+    }
+}
+
+static void identity_digest(FileMetadata* fm) {
+    struct {
+        char tag[16];
+        uint64_t device;
+        uint64_t clone_id;
+        uint64_t size;
+    } identity = {
+        .tag = "extent identity",
+        .device = fm->device,
+        .clone_id = fm->clone_id,
+        .size = fm->size,
+    };
+
+    CC_SHA256_CTX c = { 0 };
+    CC_SHA256_Init(&c);
+    CC_SHA256_Update(&c, &identity, sizeof(identity));
+    CC_SHA256_Final(fm->sha256, &c);
+    fm->identity_digest = true;
+}
+
+// like `populate_sha256_if_empty`, but adds the number of bytes read to
+// `hashed` when a digest was actually computed.
+static int populate_sha256_counting(FileMetadata* fm, size_t* hashed) {
+    if (!SHA_IS_EMPTY(fm->sha256)) {
+        return 0;
+    }
+
+    int r = populate_sha256_if_empty(fm);
+    if (!r && hashed) {
+        *hashed += fm->size;
+    }
+    return r;
+}
+
+// a key standing in for a digest of the content of `fm`, which files
+// proven identical to it byte by byte share
+static void compared_digest(FileMetadata* fm) {
+    struct {
+        char tag[16];
+        uint64_t device;
+        uint64_t inode;
+        uint64_t size;
+    } compared = {
+        .tag = "compared",
+        .device = fm->device,
+        .inode = fm->inode,
+        .size = fm->size,
+    };
+
+    CC_SHA256(&compared, sizeof(compared), fm->sha256);
+    fm->identity_digest = true;
+}
+
+// reads `fm` and every file in `candidates` in lockstep, dropping candidates
+// as soon as they differ. returns the index of the candidate with the same
+// content as `fm`, -1 if there is none, or -2 if a file could not be read.
+static ssize_t compare_lockstep(AList* candidates, FileMetadata* fm, size_t* hashed) {
+    size_t count = alist_size(candidates);
+    int fds[VISITED_COMPARE_MAX + 1];
+    bool same[VISITED_COMPARE_MAX];
+    size_t remaining = count;
+    ssize_t result = -1;
+
+    StatsSpan span = stats_begin(STATS_HASH);
+    span.size = fm->size;
+
+    uint8_t* buffer = malloc((count + 1) * COMPARE_WINDOW_SIZE);
+    size_t opened = 0;
+    for (; buffer && opened <= count; opened++) {
+        const char* path = opened < count
+            ? ((FileMetadata*) alist_get(candidates, opened))->path
+            : fm->path;
+        stats_syscall(STATS_SYSCALL_OPEN);
+        fds[opened] = vfs->open(path);
+        if (fds[opened] < 0) {
+            fprintf(stderr, "failed to open %s\n", path);
+            perror("open");
+            break;
+        }
+        if (opened < count) {
+            same[opened] = true;
+        }
+    }
+    if (!buffer || opened <= count) {
+        result = -2;
+        goto cleanup;
+    }
+
+    uint8_t* theirs = buffer + COMPARE_WINDOW_SIZE;
+    for (size_t offset = 0; remaining && offset < fm->size; offset += COMPARE_WINDOW_SIZE) {
+        size_t window = fm->size - offset < COMPARE_WINDOW_SIZE
+            ? fm->size - offset
+            : COMPARE_WINDOW_SIZE;
+
+        // start reading the next window of every file still being compared
+        // so they are all outstanding while this window is compared
+        size_t next = offset + COMPARE_WINDOW_SIZE;
+        if (vfs->advise && next < fm->size) {
+            for (size_t i = 0; i <= count; i++) {
+                if (i == count || same[i]) {
+                    vfs->advise(fds[i], next, COMPARE_WINDOW_SIZE);
+                }
+            }
+        }
+
+        stats_syscall(STATS_SYSCALL_READ);
+        if (vfs->pread(fds[count], buffer, window, offset) != (ssize_t) window) {
+            result = -2;
+            goto cleanup;
+        }
+        size_t bytes = window;
+
+        for (size_t i = 0; i < count; i++) {
+            if (!same[i]) {
+                continue;
+            }
+
+            uint8_t* b = theirs + i * COMPARE_WINDOW_SIZE;
+            stats_syscall(STATS_SYSCALL_READ);
+            if (vfs->pread(fds[i], b, window, offset) != (ssize_t) window) {
+                result = -2;
+                goto cleanup;
+            }
+            bytes += window;
+
+            if (memcmp(buffer, b, window)) {
+                same[i] = false;
+                remaining--;
+            }
+        }
+
+        stats_read(bytes);
+        if (hashed) {
+            *hashed += bytes;
+        }
+    }
+
+    // candidates are known to differ from each other, so at most one is left
+    for (size_t i = 0; remaining && i < count; i++) {
+        if (same[i]) {
+            result = i;
+            break;
+        }
+    }
+
+cleanup:
+    for (size_t i = 0; i < opened; i++) {
+        vfs->close(fds[i]);
+    }
+    free(buffer);
+    stats_end(&span);
+    return result;
+}
+
+static bool compare_pending(CharNode* last_node, FileMetadata* fm) {
+    // replays only know digests, and recordings need them
+    if (vfs->digest || record_enabled) {
+        return false;
+    }
+    // small files were already hashed while they were probed
+    if (fm->size <= SMALL_FILE_SIZE) {
+        return false;
+    }
+    // every identical file re-reads the pending one it matches, so for
+    // larger groups reading each file once to hash it is cheaper
+    return last_node->visits <= visited_compare_limit;
+}
+
+// hashes every pending file of `last_node` and moves it into the digest
+// layer, so any later file can be found with a single digest
+static void hash_pending(CharNode* last_node, size_t* hashed) {
+    for (size_t i = 0; i < alist_size(last_node->pending); i++) {
+        FileMetadata* pending = alist_get(last_node->pending, i);
+
+        // keys that stand in for digests cannot be compared with digests
+        // of the content of other files
+        if (pending->identity_digest) {
+            memset(pending->sha256, 0, 32);
+            pending->identity_digest = false;
+        }
+
+        if (populate_sha256_counting(pending, hashed) ||
+            SHA_IS_EMPTY(pending->sha256)) {
+            fprintf(stderr,
+                    "Could not compute SHA-256 for %s\n",
+                    pending->path);
+            free_metadata(pending);
+            continue;
+        }
+
+        FileMetadataNode* fm_node = calloc(1, sizeof(FileMetadataNode));
+        fm_node->fm = *pending;
+        // n.b.! the path string is now owned by the FM in the
+        //       FileMetadataNode. It is not freed here.
+        free(pending);
+        if (rb_tree_insert_node(&last_node->children, fm_node) != fm_node) {
+            free_metadata_node(fm_node);
+        }
+    }
+
+    free_alist(last_node->pending);
+    last_node->pending = NULL;
+}
+
+static FileMetadata* insert_visited(CharNode* last_node, FileMetadata* fm, size_t* hashed) {
     rb_tree_t* sha256_tree = &last_node->children;
 
+    // until there are more distinct files than can be compared with each
+    // other, files are kept pending instead of being hashed.
     if (rb_tree_count(&last_node->children) == 0) {
-        // if there aren't any children this may be a new node
-        // or it may already have a shortcut in place.
-        if (last_node->fm == NULL) {
-            last_node->fm = metadata_dup(fm);
+        if (last_node->pending == NULL) {
+            last_node->pending = new_alist_with_capacity(2);
+            last_node->visits = 1;
+            alist_add(last_node->pending, metadata_dup(fm));
             return NULL;
-        } else {
-            if (populate_sha256_if_empty(last_node->fm) ||
-                SHA_IS_EMPTY(last_node->fm->sha256)) {
-                fprintf(stderr,
-                        "Could not compute SHA-256 for %s\n",
-                        last_node->fm->path);
-                free(last_node->fm);
-                last_node->fm = metadata_dup(fm);
-                return NULL;
+        }
 
+        AList* pending = last_node->pending;
+        last_node->visits++;
+        // a clone id of 0 was not read from the extents, and says nothing
+        // about which files share them
+        if (vfs->extent_clone_ids && fm->clone_id != 0) {
+            for (size_t i = 0; i < alist_size(pending); i++) {
+                FileMetadata* p = alist_get(pending, i);
+                if (p->clone_id != fm->clone_id) {
+                    continue;
+                }
+                // both files map to the same extents, so they have the
+                // same content. a digest of the extents stands in for one
+                // of the content so they end up in the same duplicate list.
+                if (SHA_IS_EMPTY(p->sha256)) {
+                    identity_digest(p);
+                }
+                memcpy(fm->sha256, p->sha256, 32);
+                fm->identity_digest = p->identity_digest;
+                return p;
             }
+        }
 
-            if (populate_sha256_if_empty(fm) ||
-                SHA_IS_EMPTY(fm->sha256)) {
-                fprintf(stderr,
-                        "Could not compute SHA-256 for %s\n",
-                        fm->path);
-                return NULL;
+        if (compare_pending(last_node, fm)) {
+            ssize_t match = compare_lockstep(pending, fm, hashed);
+            if (match >= 0) {
+                // proven identical, so the pending file's key (or a new
+                // one) stands in for a digest of both
+                FileMetadata* p = alist_get(pending, match);
+                if (SHA_IS_EMPTY(p->sha256)) {
+                    compared_digest(p);
+                }
+                memcpy(fm->sha256, p->sha256, 32);
+                fm->identity_digest = p->identity_digest;
+                return p;
             }
-
-            if (memcmp(last_node->fm->sha256, fm->sha256, 32) == 0) {
-                // the shortcut node is the same, return a
-                // pointer to the original node
-                return last_node->fm;
-            } else {
-                // the shortcut node is not the same, it needs to
-                // be inserted into the tree along with the new
-                // node
-                FileMetadataNode* last_fm_node = calloc(1, sizeof(FileMetadataNode));
-                last_fm_node->fm = *last_node->fm;
-                rb_tree_insert_node(sha256_tree, last_fm_node);
-                // n.b.! the path string is now owned by the FM
-                //       in the FileMetadataNode. It is not
-                //       freed here.
-                free(last_node->fm); last_node->fm = NULL;
-
-                FileMetadataNode* fm_node = calloc(1, sizeof(FileMetadataNode));
-                fm_node->fm = *fm;
-                fm_node->fm.path = strdup(fm->path);
-                rb_tree_insert_node(sha256_tree, fm_node);
+            if (match == -1) {
+                alist_add(pending, metadata_dup(fm));
                 return NULL;
             }
+            // a file could not be read. fall back to digests, which report
+            // which one it was
         }
+
+        hash_pending(last_node, hashed);
     }
 
-    if (populate_sha256_if_empty(fm) ||
+    if (populate_sha256_counting(fm, hashed) ||
         SHA_IS_EMPTY(fm->sha256)) {
         fprintf(stderr,
                 "Could not compute SHA-256 for %s\n",
@@ -365,6 +829,39 @@ FileMetadata* visited_tree_insert(rb_tree_t* tree, FileMetadata* fm) {
     return NULL;
 }
 
+static FileMetadata* insert_visited_probed(CharNode* last_node, FileMetadata* fm, size_t* hashed) {
+    if (!DEDUP_VISITED_INSERT_ENABLED()) {
+        return insert_visited(last_node, fm, hashed);
+    }
+
+    uint64_t started = stats_now();
+    FileMetadata* found = insert_visited(last_node, fm, hashed);
+    DEDUP_VISITED_INSERT(fm->path, fm->size, stats_now() - started, found != NULL);
+    return found;
+}
+
+FileMetadata* visited_tree_insert(rb_tree_t* tree, FileMetadata* fm, size_t* hashed) {
+    return insert_visited_probed(visited_tree_find_or_create_last_node(tree, fm), fm, hashed);
+}
+
+FileMetadata* visited_tree_insert_shared(rb_tree_t* tree,
+                                         pthread_mutex_t* tree_mutex,
+                                         FileMetadata* fm,
+                                         size_t* hashed) {
+    CharNode* last_node = NULL;
+    STATS_LOCKED(tree_mutex, "visited_mutex", {
+        last_node = visited_tree_find_or_create_last_node(tree, fm);
+    });
+
+    // nodes are never removed while files are inserted, so only this one
+    // needs to stay locked while files are compared and hashed
+    FileMetadata* found = NULL;
+    STATS_LOCKED(&last_node->mutex, "visited_node_mutex", {
+        found = metadata_dup(insert_visited_probed(last_node, fm, hashed));
+    });
+    return found;
+}
+
 size_t visited_tree_count(rb_tree_t* dup_tree) {
     size_t count = 0;
 
@@ -400,15 +897,23 @@ size_t visited_tree_count(rb_tree_t* dup_tree) {
     return count;
 }
 
+// files on different devices cannot be cloned to each other, so they are
+// never in the same list even if their content is the same
 signed int compare_metadata_sha256_list_node(void *context, const void *node1, const void *node2) {
     const SHA256ListNode* a = node1, * b = node2;
+    if (a->device != b->device) {
+        return a->device < b->device ? -1 : 1;
+    }
     return memcmp(a->sha256, b->sha256, 32);
 }
 
 signed int compare_metadata_sha256_list_key(void *context, const void *node, const void *key) {
     const SHA256ListNode* a = node;
-    const char* sha256 = key;
-    return memcmp(a->sha256, sha256, 32);
+    const FileMetadata* fm = key;
+    if (a->device != fm->device) {
+        return a->device < fm->device ? -1 : 1;
+    }
+    return memcmp(a->sha256, fm->sha256, 32);
 }
 
 static const rb_tree_ops_t SHA256_LIST_OPS = {
@@ -427,9 +932,10 @@ rb_tree_t* new_duplicate_tree() {
 }
 
 AList* duplicate_tree_find(rb_tree_t* tree, FileMetadata* fm) {
-    SHA256ListNode* list_node = rb_tree_find_node(tree, fm->sha256);
+    SHA256ListNode* list_node = rb_tree_find_node(tree, fm);
     if (!list_node) {
         list_node = malloc(sizeof(SHA256ListNode));
+        list_node->device = fm->device;
         memcpy(list_node->sha256, fm->sha256, 32);
         list_node->list = new_alist_with_capacity(2);
         rb_tree_insert_node(tree, list_node);
@@ -438,6 +944,76 @@ AList* duplicate_tree_find(rb_tree_t* tree, FileMetadata* fm) {
     return list_node->list;
 }
 
+// finds the visited tree entry for the same file as `fm`
+static FileMetadata* visited_tree_find(rb_tree_t* tree, const FileMetadata* fm) {
+    DeviceNode* device_node = rb_tree_find_node(tree, &fm->device);
+    SizeNode* size_node = device_node ? rb_tree_find_node(&device_node->children, &fm->size) : NULL;
+    CharNode* first_node = size_node ? rb_tree_find_node(&size_node->children, &fm->first) : NULL;
+    CharNode* last_node = first_node ? rb_tree_find_node(&first_node->children, &fm->last) : NULL;
+    if (!last_node) {
+        return NULL;
+    }
+
+    for (size_t i = 0; last_node->pending && i < alist_size(last_node->pending); i++) {
+        FileMetadata* pending = alist_get(last_node->pending, i);
+        if (pending->inode == fm->inode) {
+            return pending;
+        }
+    }
+
+    FileMetadataNode* node = NULL;
+    RB_TREE_FOREACH(node, &last_node->children) {
+        if (node->fm.inode == fm->inode) {
+            return &node->fm;
+        }
+    }
+    return NULL;
+}
+
+static bool alist_contains_file(AList* list, FileMetadata* fm) {
+    for (size_t i = 0; i < alist_size(list); i++) {
+        if (metadata_compare(alist_get(list, i), fm) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void duplicate_tree_merge_identities(rb_tree_t* tree, rb_tree_t* visited) {
+    // the first file of each list is the one the others were matched with
+    AList* merged = new_alist();
+    SHA256ListNode* list_node = NULL;
+    RB_TREE_FOREACH(list_node, tree) {
+        FileMetadata* first = alist_get(list_node->list, 0);
+        FileMetadata* hashed = first->identity_digest ? visited_tree_find(visited, first) : NULL;
+        if (hashed && !hashed->identity_digest && !SHA_IS_EMPTY(hashed->sha256)) {
+            alist_add(merged, list_node);
+        }
+    }
+
+    for (size_t i = 0; i < alist_size(merged); i++) {
+        list_node = alist_get(merged, i);
+        rb_tree_remove_node(tree, list_node);
+
+        FileMetadata content = *visited_tree_find(visited, alist_get(list_node->list, 0));
+        AList* list = duplicate_tree_find(tree, &content);
+        for (size_t j = 0; j < alist_size(list_node->list); j++) {
+            FileMetadata* clone = alist_get(list_node->list, j);
+            if (alist_contains_file(list, clone)) {
+                free_metadata(clone);
+                continue;
+            }
+            memcpy(clone->sha256, content.sha256, 32);
+            clone->identity_digest = false;
+            alist_add(list, clone);
+        }
+
+        free_alist(list_node->list);
+        free(list_node);
+    }
+    free_alist(merged);
+}
+
 size_t duplicate_tree_count(rb_tree_t* vis_tree) {
     size_t count = 0;
     SHA256ListNode* node = NULL;
@@ -510,7 +1086,8 @@ FileMetadata* clone_id_tree_max(rb_tree_t* tree) {
     FileMetadata* fm = NULL;
     IDCountNode* node = NULL;
     RB_TREE_FOREACH(node, tree) {
-        if (node->count > max) {
+        if (node->count > max ||
+            (node->count == max && metadata_compare(node->fm, fm) < 0)) {
             fm = node->fm;
             max = node->count;
         }
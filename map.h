@@ -30,6 +30,7 @@
 #include <sys/attr.h>
 #include <sys/rbtree.h>
 #include <sys/stat.h>
+#include <pthread.h>
 #include <stdbool.h>
 
 #include "alist.h"
@@ -46,11 +47,24 @@ typedef struct FileMetadata {
     uint8_t sha256[32];
     char first;
     char last;
+    // set if `sha256` is a key standing in for a digest of the content:
+    // either a digest of the device, clone id, and size (see
+    // `Vfs.extent_clone_ids`) or of the file it was compared with.
+    bool identity_digest;
 } FileMetadata;
 
 void free_metadata(FileMetadata* fm);
 FileMetadata* metadata_dup(FileMetadata* fm) ATTR_MALLOC(free_metadata, 1);
 
+/// Orders files by device, inode, and then path. Unlike the order files are
+/// visited in, this does not depend on thread scheduling, so it is used to
+/// break ties wherever one file has to be chosen over another.
+int metadata_compare(const FileMetadata* a, const FileMetadata* b) __attribute__((pure));
+
+/// Sets the digest of `fm` from `buffer`, which holds all `fm->size` bytes
+/// of the file, so the file never has to be opened again to be compared.
+void populate_sha256_from_buffer(FileMetadata* fm, const void* buffer);
+
 /// Visited Tree
 ///
 /// The tree of visited file metadata is constructed in a way
@@ -72,12 +86,20 @@ FileMetadata* metadata_dup(FileMetadata* fm) ATTR_MALLOC(free_metadata, 1);
 /// be written in fixed blocks. The first character and last
 /// character of the file are compared.
 ///
+/// Files of at most `SMALL_FILE_SIZE` bytes are read whole when their first
+/// and last characters are, and arrive with their SHA-256 already computed.
+///
 /// At this point in the tree the file metadata is stashed until
 /// another file with the same device, size, first and last
-/// character is found. When that occurs, a SHA-256 hash is
-/// computed for both files. If they are the same, the tree does
-/// not change. If they are different, a new layer is added to
-/// the tree based on the hash.
+/// character is found. If clone ids are derived from extents and
+/// both files have the same one, they are known to be identical
+/// without reading either. Otherwise the files are read in
+/// lockstep and compared byte by byte, stopping as soon as they
+/// differ. Files that differ from every stashed file are stashed
+/// too. Once more than `visited_compare_limit` files have been
+/// found, comparing each new one costs more than hashing, so a
+/// SHA-256 hash is computed for each stashed file and a new layer
+/// is added to the tree based on the hash.
 ///
 /// device ->
 ///   size ->
@@ -101,8 +123,13 @@ typedef struct FileMetadataNode {
 typedef struct CharNode {
     rb_node_t node;
     rb_tree_t children; // depending on the level, either another CharNode tree or a FileMeatadata tree
-    // pre-hash check
-    FileMetadata* fm;
+    // files with distinct content that have not been hashed
+    AList* pending;
+    // files inserted while some were pending
+    size_t visits;
+    // held while files are compared and hashed by `visited_tree_insert_shared`
+    // (last character nodes only)
+    pthread_mutex_t mutex;
     char c;
 } CharNode;
 
@@ -118,8 +145,50 @@ typedef struct DeviceNode {
     dev_t d;
 } DeviceNode;
 
+/// The most files that are compared with each other in lockstep.
+#define VISITED_COMPARE_MAX 8
+
+/// Files with the same device, size, first, and last character are compared
+/// byte by byte until more than this many have been found, and hashed after
+/// that. At most `VISITED_COMPARE_MAX`. If less than 2, files are always
+/// hashed. Must only be changed before any files are inserted.
+extern size_t visited_compare_limit;
+
+/// Files of at least this many bytes are hashed in `HASH_CHUNK_SIZE` chunks
+/// which are hashed concurrently. Their digest is the SHA-256 of the SHA-256
+/// of each chunk rather than of the content, which is only ever compared with
+/// the digests of other files of the same size.
+#define CHUNKED_HASH_SIZE (64 * 1024 * 1024)
+#define HASH_CHUNK_SIZE (8 * 1024 * 1024)
+
+/// Starts `count` more threads that hash the chunks of files of at least
+/// `CHUNKED_HASH_SIZE` bytes alongside the thread hashing each file, which
+/// otherwise hashes every chunk itself. The threads are shared by every
+/// file being hashed and run until `hash_pool_stop`. Returns the number of
+/// threads started.
+unsigned hash_pool_add(unsigned count);
+
+/// Stops every thread started by `hash_pool_add`. No file may be hashed
+/// meanwhile.
+void hash_pool_stop(void);
+
 rb_tree_t* new_visited_tree() ATTR_MALLOC(free_visited_tree, 1);
-FileMetadata* visited_tree_insert(rb_tree_t* tree, FileMetadata* fm);
+
+/// Inserts `fm` into the visited tree. If a file with the same content has
+/// already been visited, its metadata is returned. If `hashed` is not `NULL`
+/// the number of bytes read to compute digests during the insert is added to
+/// it.
+FileMetadata* visited_tree_insert(rb_tree_t* tree, FileMetadata* fm, size_t* hashed);
+
+/// Like `visited_tree_insert`, for trees shared by several threads. The tree
+/// is locked with `tree_mutex` only to find where `fm` goes. Files are then
+/// compared and hashed with only the files of the same size, first, and last
+/// character locked, so other files can be inserted meanwhile. Returns a copy
+/// of the metadata found, which the caller must free.
+FileMetadata* visited_tree_insert_shared(rb_tree_t* tree,
+                                         pthread_mutex_t* tree_mutex,
+                                         FileMetadata* fm,
+                                         size_t* hashed);
 size_t visited_tree_count(rb_tree_t* dup_tree) __attribute__((pure));
 void free_visited_tree(rb_tree_t* t);
 
@@ -133,11 +202,20 @@ void free_visited_tree(rb_tree_t* t);
 typedef struct SHA256ListNode {
     rb_node_t node;
     AList* list;
+    dev_t device;
     uint8_t sha256[32];
 } SHA256ListNode;
 
 rb_tree_t* new_duplicate_tree() ATTR_MALLOC(free_duplicate_tree, 1);
 AList* duplicate_tree_find(rb_tree_t* tree, FileMetadata* fm);
+
+/// Files matched before their content was hashed are listed under a key
+/// standing in for a digest: either of their extents (see
+/// `Vfs.extent_clone_ids`) or of the file they were compared with. If more
+/// copies were found later, the content of the file they were matched with
+/// was hashed too, and they are moved to the list for that content. `visited` must be the tree
+/// the duplicates were found with, and no other thread may be using either.
+void duplicate_tree_merge_identities(rb_tree_t* tree, rb_tree_t* visited);
 size_t duplicate_tree_count(rb_tree_t* vis_tree);
 void free_duplicate_tree(rb_tree_t* t);
 
@@ -154,6 +232,8 @@ typedef struct IDCountNode {
 
 rb_tree_t* new_clone_id_counts() ATTR_MALLOC(free_clone_id_counts, 1);
 size_t clone_id_tree_increment(rb_tree_t* tree, FileMetadata* fm);
+/// Returns a file with the most common clone id. Ties go to the clone id
+/// whose first file comes first by `metadata_compare`.
 FileMetadata* clone_id_tree_max(rb_tree_t* tree) __attribute__((pure));
 void free_clone_id_counts(rb_tree_t* tree);
 
@@ -27,38 +27,181 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <unistd.h>
 
 #include "progress.h"
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 
-void display_progress(const Progress* progress) {
-    struct winsize w;
-    ioctl(0, TIOCGWINSZ, &w);
+// weight given to the most recent sample when smoothing the transfer rate
+#define RATE_SMOOTHING 0.2
 
-    size_t width = w.ws_col - 23 - (progress->note ? strlen(progress->note) : 6);
+static double elapsed_seconds(const struct timespec* from, const struct timespec* to) {
+    return (double) (to->tv_sec - from->tv_sec) +
+        (double) (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static void format_bytes(char* out, size_t size, double v) {
+    char* unit = "B";
+
+    if (v > 1000.0) {
+        v /= 1000.0;
+        unit = "kB";
+    }
+    if (v > 1000.0) {
+        v /= 1000.0;
+        unit = "MB";
+    }
+    if (v > 1000.0) {
+        v /= 1000.0;
+        unit = "GB";
+    }
+    if (v > 1000.0) {
+        v /= 1000.0;
+        unit = "TB";
+    }
+
+    snprintf(out, size, "%.1f %s", v, unit);
+}
+
+static void format_duration(char* out, size_t size, double seconds) {
+    if (seconds < 0 || seconds > 360000.0) {
+        snprintf(out, size, "--:--");
+        return;
+    }
+
+    unsigned long s = seconds;
+    if (s >= 3600) {
+        snprintf(out, size, "%lu:%02lu:%02lu", s / 3600, (s / 60) % 60, s % 60);
+    } else {
+        snprintf(out, size, "%lu:%02lu", s / 60, s % 60);
+    }
+}
+
+void display_progress(Progress* progress) {
+    const Counters* counters = progress->counters;
+    uint64_t total_units = counters_sum(counters, COUNTER_TOTAL_UNITS),
+             completed_units = counters_sum(counters, COUNTER_COMPLETED_UNITS),
+             total_bytes = counters_sum(counters, COUNTER_TOTAL_BYTES),
+             probed_bytes = counters_sum(counters, COUNTER_PROBED_BYTES),
+             hashed_bytes = counters_sum(counters, COUNTER_HASHED_BYTES),
+             completed_bytes = counters_sum(counters, COUNTER_COMPLETED_BYTES);
+
+    // shards are read one at a time, so workers may have completed files
+    // which are not yet reflected in the totals read above
+    completed_units = MIN(completed_units, total_units);
+    completed_bytes = MIN(completed_bytes, total_bytes);
+    probed_bytes = MIN(probed_bytes, total_bytes);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double interval = elapsed_seconds(&progress->sampled, &now);
+    if (interval > 0 && completed_bytes >= progress->sampledByteCount) {
+        double rate = (completed_bytes - progress->sampledByteCount) / interval;
+        progress->rate = progress->rate
+            ? RATE_SMOOTHING * rate + (1.0 - RATE_SMOOTHING) * progress->rate
+            : rate;
+    }
+    progress->sampled = now;
+    progress->sampledByteCount = completed_bytes;
+
+    double percent_complete = total_bytes
+        ? (double) completed_bytes / (double) total_bytes
+        : 0.0;
+
+    char completed[16], total[16], probed[16], hashed[16], rate[16], eta[16];
+    format_bytes(completed, sizeof(completed), completed_bytes);
+    format_bytes(total, sizeof(total), total_bytes);
+    format_bytes(probed, sizeof(probed), probed_bytes);
+    format_bytes(hashed, sizeof(hashed), hashed_bytes);
+    format_bytes(rate, sizeof(rate), progress->rate);
+    format_duration(eta,
+                    sizeof(eta),
+                    progress->rate > 0
+                        ? (total_bytes - completed_bytes) / progress->rate
+                        : -1);
+
+    char status[256];
+    int status_length = snprintf(status,
+                                 sizeof(status),
+                                 "] %.0f%% %s of %s (%llu of %llu files) probed %s hashed %s %s/s ETA %s %s",
+                                 percent_complete * 100.0,
+                                 completed,
+                                 total,
+                                 (unsigned long long) completed_units,
+                                 (unsigned long long) total_units,
+                                 probed,
+                                 hashed,
+                                 rate,
+                                 eta,
+                                 progress->note ?: "");
+    status_length = MIN(status_length, (int) sizeof(status) - 1);
+
+    struct winsize w = { 0 };
+    ioctl(STDERR_FILENO, TIOCGWINSZ, &w);
+
+    // leave room for the opening bracket and the cursor
+    int width = MAX((int) w.ws_col - status_length - 2, 0);
     width = MIN(width, 80);
 
     clear_progress();
     fputc('[', stderr);
-    double percent_complete = (double) progress->completedUnitCount / (double) progress->totalUnitCount;
-    size_t complete = width * percent_complete;
-    for (size_t i = 0; i < width; i++) {
+    int complete = width * percent_complete;
+    for (int i = 0; i < width; i++) {
         if (i <= complete) {
             fputc('#', stderr);
         } else {
             fputc(' ', stderr);
         }
     }
-    fprintf(stderr, "] %.0f%% (%llu of %llu) %s",
-            percent_complete * 100.0,
-            progress->completedUnitCount,
-            progress->totalUnitCount,
-            progress->note ?: "");
+    fputs(status, stderr);
     fflush(stderr);
 }
 
+static void* render_progress(void* context) {
+    Progress* progress = context;
+    const struct timespec interval = {
+        .tv_sec = 0,
+        .tv_nsec = PROGRESS_INTERVAL_MS * 1000000L,
+    };
+
+    while (atomic_load_explicit(&progress->rendering, memory_order_acquire)) {
+        pthread_mutex_lock(progress->output_mutex);
+        display_progress(progress);
+        pthread_mutex_unlock(progress->output_mutex);
+
+        nanosleep(&interval, NULL);
+    }
+
+    return NULL;
+}
+
+int start_progress(Progress* progress, pthread_mutex_t* output_mutex) {
+    progress->output_mutex = output_mutex;
+    clock_gettime(CLOCK_MONOTONIC, &progress->sampled);
+    progress->sampledByteCount = 0;
+    progress->rate = 0;
+
+    atomic_store_explicit(&progress->rendering, true, memory_order_release);
+    int r = pthread_create(&progress->render_thread, NULL, render_progress, progress);
+    if (r) {
+        atomic_store_explicit(&progress->rendering, false, memory_order_release);
+    }
+    return r;
+}
+
+void stop_progress(Progress* progress) {
+    if (!atomic_exchange_explicit(&progress->rendering, false, memory_order_acq_rel)) {
+        return;
+    }
+
+    pthread_join(progress->render_thread, NULL);
+
+    pthread_mutex_lock(progress->output_mutex);
+    clear_progress();
+    pthread_mutex_unlock(progress->output_mutex);
+}
 
 void clear_progress() {
     fprintf(stderr, "\r\033[K");
@@ -27,22 +27,57 @@
 #ifndef __DEDUP_PROGRESS_H__
 #define __DEDUP_PROGRESS_H__
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 
+#include "counters.h"
+
+/// Progress is read from the shared `Counters`, so reporting progress from
+/// any thread is only a matter of updating that thread's `CounterShard`.
+///
+/// Work is tracked both in files (units) and in bytes. The byte counters are
+/// broken out per stage: `COUNTER_PROBED_BYTES` is the logical size of files
+/// whose first and last bytes have been read, `COUNTER_HASHED_BYTES` is the
+/// number of bytes actually read to compute a digest, and
+/// `COUNTER_COMPLETED_BYTES` is the logical size of files that have been
+/// fully evaluated. The percentage and ETA are derived from completed bytes
+/// so that one very large file is not counted the same as one very small one.
 typedef struct Progress {
-    uint64_t totalUnitCount;
-    uint64_t completedUnitCount;
+    Counters* counters;
     void* context;
     char* note;
+
+    // render thread state
+    pthread_mutex_t* output_mutex;
+    pthread_t render_thread;
+    atomic_bool rendering;
+    struct timespec sampled;
+    uint64_t sampledByteCount;
+    double rate;
 } Progress;
 
+/// How often the render thread redraws the progress bar.
+#define PROGRESS_INTERVAL_MS 100
+
 /// Disables further progress output until `enable_progress` is called. This is
 /// useful for scenarios where a global event has occurred (like a signal being
 /// caught.
 void disable_progress();
 void enable_progress();
 
-void display_progress(const Progress* progress);
+/// Starts a thread which redraws `progress` every `PROGRESS_INTERVAL_MS`.
+/// `output_mutex` is held while drawing. Any other thread writing to the
+/// terminal must hold it and call `clear_progress` before doing so.
+int start_progress(Progress* progress, pthread_mutex_t* output_mutex);
+
+/// Stops the render thread started by `start_progress`, waits for it to exit,
+/// and clears the progress bar.
+void stop_progress(Progress* progress);
+
+void display_progress(Progress* progress);
 void clear_progress();
 
 #endif // __DEDUP_PROGRESS_H__
@@ -31,6 +31,9 @@
 
 FileEntryHead* new_file_entry_queue() {
     FileEntryHead* head = malloc(sizeof(FileEntryHead));
+    if (!head) {
+        return NULL;
+    }
     STAILQ_INIT(head);
 
     return head;
@@ -61,6 +64,10 @@ void file_entry_queue_append(FileEntryHead* queue,
     STAILQ_INSERT_TAIL(queue, e, entries);
 }
 
+void file_entry_queue_push(FileEntryHead* queue, FileEntry* fe) {
+    STAILQ_INSERT_TAIL(queue, fe, entries);
+}
+
 FileEntry* file_entry_next(FileEntryHead* queue) {
      if (STAILQ_EMPTY(queue)) {
          return NULL;
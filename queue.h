@@ -31,6 +31,8 @@
 #include <sys/queue.h>
 #include <stdbool.h>
 
+struct FileMetadata;
+
 STAILQ_HEAD(FileEntryHead, FileEntry);
 
 typedef struct FileEntryHead FileEntryHead;
@@ -44,6 +46,11 @@ typedef struct FileEntry {
     size_t size;
     bool acls_supported;
     short level;
+    // set once the entry has been probed by a probe thread, along with the
+    // result and the `errno` of the probe if it failed
+    bool probed;
+    struct FileMetadata* fm;
+    int error;
     STAILQ_ENTRY(FileEntry) entries;    /* Tail queue. */
 } FileEntry;
 
@@ -58,6 +65,8 @@ void file_entry_queue_append(FileEntryHead* queue,
                              uint32_t flags,
                              size_t size,
                              short level);
+/// Appends an entry taken from another queue.
+void file_entry_queue_push(FileEntryHead* queue, FileEntry* fe);
 FileEntry* file_entry_next(FileEntryHead* queue);
 void file_entry_free(FileEntry* fe);
 
@@ -0,0 +1,140 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "record.h"
+
+// records are small, so buffer generously to keep the lock cheap
+#define RECORD_BUFFER_SIZE (1 << 20)
+
+bool record_enabled = false;
+
+static FILE* record_file = NULL;
+static pthread_mutex_t record_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int record_open(const char* path, uint32_t flags) {
+    record_file = fopen(path, "w");
+    if (!record_file) {
+        return -1;
+    }
+    setvbuf(record_file, NULL, _IOFBF, RECORD_BUFFER_SIZE);
+
+    RecordHeader header = {
+        .version = RECORD_VERSION,
+        .flags = flags,
+    };
+    memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+    if (fwrite(&header, sizeof(header), 1, record_file) != 1) {
+        fclose(record_file);
+        record_file = NULL;
+        return -1;
+    }
+
+    record_enabled = true;
+    return 0;
+}
+
+int record_close() {
+    if (!record_file) {
+        return 0;
+    }
+    record_enabled = false;
+
+    int r = ferror(record_file);
+    r |= fclose(record_file);
+    record_file = NULL;
+    return r;
+}
+
+static void write_record(char type, const void* record, size_t size, const char* tail, size_t tail_size) {
+    pthread_mutex_lock(&record_mutex);
+    fputc(type, record_file);
+    fwrite(record, size, 1, record_file);
+    if (tail_size) {
+        fwrite(tail, tail_size, 1, record_file);
+    }
+    pthread_mutex_unlock(&record_mutex);
+}
+
+void record_entry(const char* path,
+                  dev_t device,
+                  ino_t inode,
+                  nlink_t nlink,
+                  uint32_t flags,
+                  off_t size,
+                  short level) {
+    size_t length = strnlen(path, UINT16_MAX);
+    RecordEntry e = {
+        .device = device,
+        .inode = inode,
+        .nlink = nlink,
+        .flags = flags,
+        .size = size,
+        .level = level,
+        .path_length = length,
+    };
+    write_record(RECORD_ENTRY, &e, sizeof(e), path, length);
+}
+
+void record_probe(dev_t device,
+                  ino_t inode,
+                  char first,
+                  char last,
+                  uint64_t clone_id,
+                  size_t allocated_size,
+                  size_t private_size) {
+    RecordProbe p = {
+        .device = device,
+        .inode = inode,
+        .clone_id = clone_id,
+        .allocated_size = allocated_size,
+        .private_size = private_size,
+        .first = first,
+        .last = last,
+    };
+    write_record(RECORD_PROBE, &p, sizeof(p), NULL, 0);
+}
+
+void record_digest(dev_t device, ino_t inode, const uint8_t sha256[32]) {
+    RecordDigest d = {
+        .device = device,
+        .inode = inode,
+    };
+    memcpy(d.sha256, sha256, sizeof(d.sha256));
+    write_record(RECORD_DIGEST, &d, sizeof(d), NULL, 0);
+}
+
+void record_fragments(dev_t device, ino_t inode, size_t fragments) {
+    RecordFragments f = {
+        .device = device,
+        .inode = inode,
+        .fragments = fragments,
+    };
+    write_record(RECORD_FRAGMENTS, &f, sizeof(f), NULL, 0);
+}
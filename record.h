@@ -0,0 +1,131 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_RECORD_H__
+#define __DEDUP_RECORD_H__
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Record
+///
+/// Writes the metadata `dedup` gathers during a scan to a compact binary file
+/// which can be replayed later (see `vfs_replay`) without any access to the
+/// files themselves. Four kinds of records are written:
+///
+///   E  an entry appended to the work queue: path, device, inode, link
+///      count, flags, size, and depth
+///   P  the result of probing a file: first and last bytes, clone id, and
+///      the bytes allocated to it and not shared with any other file
+///   D  the SHA-256 digest of a file
+///   F  the number of fragments a clone origin candidate is stored in
+///
+/// P, D, and F records are keyed by device and inode. Every record starts with
+/// its one byte type and integers are written in host byte order, so a
+/// recording can only be replayed on a machine with the same byte order.
+
+#define RECORD_MAGIC "DEDUPREC"
+#define RECORD_VERSION 4
+
+/// Header flags
+///
+/// Clone ids were derived from extents (see `Vfs.extent_clone_ids`).
+#define RECORD_EXTENT_CLONE_IDS 0x1
+
+#define RECORD_ENTRY 'E'
+#define RECORD_PROBE 'P'
+#define RECORD_DIGEST 'D'
+#define RECORD_FRAGMENTS 'F'
+
+typedef struct RecordHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+} __attribute__((packed)) RecordHeader;
+
+/// Followed by `path_length` bytes of path, which is not NUL terminated.
+typedef struct RecordEntry {
+    uint64_t device;
+    uint64_t inode;
+    uint32_t nlink;
+    uint32_t flags;
+    uint64_t size;
+    uint16_t level;
+    uint16_t path_length;
+} __attribute__((packed)) RecordEntry;
+
+typedef struct RecordProbe {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t clone_id;
+    uint64_t allocated_size;
+    uint64_t private_size;
+    char first;
+    char last;
+} __attribute__((packed)) RecordProbe;
+
+typedef struct RecordDigest {
+    uint64_t device;
+    uint64_t inode;
+    uint8_t sha256[32];
+} __attribute__((packed)) RecordDigest;
+
+typedef struct RecordFragments {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t fragments;
+} __attribute__((packed)) RecordFragments;
+
+extern bool record_enabled;
+
+/// Opens `path` for writing and enables recording. `flags` are written to
+/// the header. Must be called before any other threads are started. Returns
+/// 0 on success.
+int record_open(const char* path, uint32_t flags);
+
+/// Writes any buffered records and closes the recording. Returns 0 on
+/// success.
+int record_close();
+
+void record_entry(const char* path,
+                  dev_t device,
+                  ino_t inode,
+                  nlink_t nlink,
+                  uint32_t flags,
+                  off_t size,
+                  short level);
+void record_probe(dev_t device,
+                  ino_t inode,
+                  char first,
+                  char last,
+                  uint64_t clone_id,
+                  size_t allocated_size,
+                  size_t private_size);
+void record_digest(dev_t device, ino_t inode, const uint8_t sha256[32]);
+void record_fragments(dev_t device, ino_t inode, size_t fragments);
+
+#endif // __DEDUP_RECORD_H__
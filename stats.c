@@ -0,0 +1,480 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+typedef struct ThreadStats {
+    StageStats stages[STATS_STAGE_COUNT];
+    StatsStage current;
+    struct ThreadStats* next;
+} ThreadStats;
+
+bool stats_enabled = false;
+
+static uint64_t started = 0;
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+// the stats of threads that have exited are added to the first entry
+static ThreadStats retired = { 0 };
+static ThreadStats* registry = &retired;
+static pthread_once_t thread_stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_stats_key;
+static _Thread_local ThreadStats* thread_stats = NULL;
+static LockSite* lock_sites = NULL;
+
+static const char* const STAGE_NAMES[STATS_STAGE_COUNT] = {
+    [STATS_NONE] = "other",
+    [STATS_WALK] = "walk",
+    [STATS_PROBE] = "probe",
+    [STATS_HASH] = "hash",
+    [STATS_LOCK_WAIT] = "lock_wait",
+    [STATS_DEDUPLICATE] = "deduplicate",
+    [STATS_APPLY] = "apply",
+    [STATS_APPLY_STAGE] = "apply_stage",
+    [STATS_APPLY_CLONE] = "apply_clone",
+    [STATS_APPLY_METADATA] = "apply_metadata",
+    [STATS_APPLY_RENAME] = "apply_rename",
+    [STATS_APPLY_VERIFY] = "apply_verify",
+};
+
+static const char* const SYSCALL_NAMES[STATS_SYSCALL_COUNT] = {
+    [STATS_SYSCALL_OPEN] = "open",
+    [STATS_SYSCALL_READ] = "read",
+    [STATS_SYSCALL_MMAP] = "mmap",
+    [STATS_SYSCALL_STAT] = "stat",
+    [STATS_SYSCALL_CLONE] = "clone",
+    [STATS_SYSCALL_COPYFILE] = "copyfile",
+    [STATS_SYSCALL_RENAME] = "rename",
+    [STATS_SYSCALL_UNLINK] = "unlink",
+    [STATS_SYSCALL_LINK] = "link",
+};
+
+const char* stats_stage_name(StatsStage stage) {
+    return STAGE_NAMES[stage];
+}
+
+const char* stats_syscall_name(StatsSyscall call) {
+    return SYSCALL_NAMES[call];
+}
+
+uint64_t stats_now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static uint64_t thread_cpu_now() {
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return (uint64_t) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+void stats_enable() {
+    started = stats_now();
+    stats_enabled = true;
+}
+
+void stats_reset() {
+    pthread_mutex_lock(&registry_mutex);
+    for (ThreadStats* ts = registry; ts; ts = ts->next) {
+        memset(ts->stages, 0, sizeof(ts->stages));
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    started = stats_now();
+}
+
+static void add_stage_stats(StageStats* out, const StageStats* s) {
+    out->count += s->count;
+    out->wall_ns += s->wall_ns;
+    out->cpu_ns += s->cpu_ns;
+    out->bytes_read += s->bytes_read;
+    if (s->max_ns > out->max_ns) {
+        out->max_ns = s->max_ns;
+    }
+    for (size_t i = 0; i < STATS_SYSCALL_COUNT; i++) {
+        out->syscalls[i] += s->syscalls[i];
+    }
+    for (size_t i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+        out->histogram[i] += s->histogram[i];
+    }
+}
+
+// adds the stats of a thread that is exiting to `retired` and frees them
+static void retire_thread_stats(void* value) {
+    ThreadStats* ts = value;
+
+    pthread_mutex_lock(&registry_mutex);
+    ThreadStats** link = &registry;
+    while (*link && *link != ts) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = ts->next;
+    }
+    for (size_t i = 0; i < STATS_STAGE_COUNT; i++) {
+        add_stage_stats(&retired.stages[i], &ts->stages[i]);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+
+    free(ts);
+}
+
+static void create_thread_stats_key() {
+    pthread_key_create(&thread_stats_key, retire_thread_stats);
+}
+
+static ThreadStats* current_thread_stats() {
+    if (!thread_stats) {
+        pthread_once(&thread_stats_once, create_thread_stats_key);
+        thread_stats = calloc(1, sizeof(ThreadStats));
+        pthread_mutex_lock(&registry_mutex);
+        thread_stats->next = registry;
+        registry = thread_stats;
+        pthread_mutex_unlock(&registry_mutex);
+        pthread_setspecific(thread_stats_key, thread_stats);
+    }
+    return thread_stats;
+}
+
+static unsigned histogram_bucket(uint64_t ns) {
+    if (ns == 0) {
+        return 0;
+    }
+    unsigned bucket = 63 - __builtin_clzll(ns);
+    return bucket < STATS_HISTOGRAM_BUCKETS ? bucket : STATS_HISTOGRAM_BUCKETS - 1;
+}
+
+StatsSpan stats_begin_span(StatsStage stage) {
+    StatsSpan span = {
+        .stage = stage,
+        .size = -1,
+    };
+
+    if (stats_enabled) {
+        ThreadStats* ts = current_thread_stats();
+        span.previous = ts->current;
+        span.cpu = thread_cpu_now();
+        ts->current = stage;
+    }
+
+    span.wall = stats_now();
+    return span;
+}
+
+void stats_end_span(StatsSpan* span) {
+    uint64_t wall = stats_now() - span->wall;
+
+    if (trace_enabled) {
+        trace_event(span->name ?: stats_stage_name(span->stage),
+                    span->wall,
+                    wall,
+                    span->size);
+    }
+
+    if (!stats_enabled) {
+        return;
+    }
+
+    ThreadStats* ts = current_thread_stats();
+    uint64_t cpu = thread_cpu_now() - span->cpu;
+
+    StageStats* s = &ts->stages[span->stage];
+    s->count++;
+    s->wall_ns += wall;
+    s->cpu_ns += cpu;
+    if (wall > s->max_ns) {
+        s->max_ns = wall;
+    }
+    s->histogram[histogram_bucket(wall)]++;
+
+    ts->current = span->previous;
+}
+
+void stats_record_syscall(StatsSyscall call) {
+    ThreadStats* ts = current_thread_stats();
+    ts->stages[ts->current].syscalls[call]++;
+}
+
+void stats_record_read(uint64_t bytes) {
+    ThreadStats* ts = current_thread_stats();
+    ts->stages[ts->current].bytes_read += bytes;
+}
+
+static void atomic_max(_Atomic uint64_t* value, uint64_t candidate) {
+    uint64_t current = atomic_load_explicit(value, memory_order_relaxed);
+    while (current < candidate &&
+           !atomic_compare_exchange_weak_explicit(value,
+                                                  &current,
+                                                  candidate,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+LockHold stats_lock_site(LockSite* site, pthread_mutex_t* mutex) {
+    uint64_t requested = stats_now();
+    uint64_t acquired = requested;
+
+    // only a wait for another thread is recorded as a span
+    bool contended = pthread_mutex_trylock(mutex) == EBUSY;
+    if (contended) {
+        StatsSpan wait = stats_begin_span(STATS_LOCK_WAIT);
+        wait.name = site->name;
+        pthread_mutex_lock(mutex);
+        acquired = stats_now();
+        stats_end_span(&wait);
+    }
+
+    if (!stats_enabled) {
+        return (LockHold) { 0 };
+    }
+
+    if (!atomic_exchange_explicit(&site->registered, true, memory_order_relaxed)) {
+        pthread_mutex_lock(&registry_mutex);
+        site->next = lock_sites;
+        lock_sites = site;
+        pthread_mutex_unlock(&registry_mutex);
+    }
+
+    uint64_t waited = acquired - requested;
+    atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&site->contended, contended, memory_order_relaxed);
+    atomic_fetch_add_explicit(&site->wait_ns, waited, memory_order_relaxed);
+    atomic_max(&site->max_wait_ns, waited);
+
+    return (LockHold) {
+        .site = site,
+        .acquired = acquired,
+    };
+}
+
+void stats_unlock_site(LockHold* hold, pthread_mutex_t* mutex) {
+    uint64_t held = stats_now() - hold->acquired;
+    pthread_mutex_unlock(mutex);
+
+    atomic_fetch_add_explicit(&hold->site->hold_ns, held, memory_order_relaxed);
+    atomic_max(&hold->site->max_hold_ns, held);
+}
+
+// returns the registered lock sites, most total wait first. the caller must
+// free the result.
+static LockSite** collect_lock_sites(size_t* count) {
+    pthread_mutex_lock(&registry_mutex);
+    size_t n = 0;
+    for (LockSite* site = lock_sites; site; site = site->next) {
+        n++;
+    }
+    LockSite** sites = calloc(n + 1, sizeof(LockSite*));
+    n = 0;
+    for (LockSite* site = lock_sites; site; site = site->next) {
+        sites[n++] = site;
+    }
+    pthread_mutex_unlock(&registry_mutex);
+
+    // insertion sort, there are only a handful of sites
+    for (size_t i = 1; i < n; i++) {
+        LockSite* site = sites[i];
+        size_t j = i;
+        for (; j > 0 && sites[j - 1]->wait_ns < site->wait_ns; j--) {
+            sites[j] = sites[j - 1];
+        }
+        sites[j] = site;
+    }
+
+    *count = n;
+    return sites;
+}
+
+void stats_collect(StatsStage stage, StageStats* out) {
+    memset(out, 0, sizeof(StageStats));
+
+    pthread_mutex_lock(&registry_mutex);
+    for (ThreadStats* ts = registry; ts; ts = ts->next) {
+        add_stage_stats(out, &ts->stages[stage]);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+uint64_t stats_percentile(const StageStats* s, double percentile) {
+    uint64_t rank = s->count * percentile,
+             seen = 0;
+    for (size_t i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+        seen += s->histogram[i];
+        if (seen > rank) {
+            // report the upper bound of the bucket
+            return i + 1 < 64 ? (1ULL << (i + 1)) : UINT64_MAX;
+        }
+    }
+    return s->max_ns;
+}
+
+static void report_text(FILE* out) {
+    fprintf(out, "elapsed: %.3f ms\n", (stats_now() - started) / 1e6);
+    for (StatsStage stage = 0; stage < STATS_STAGE_COUNT; stage++) {
+        StageStats s;
+        stats_collect(stage, &s);
+        bool syscalls = false;
+        for (size_t i = 0; i < STATS_SYSCALL_COUNT; i++) {
+            syscalls |= s.syscalls[i] != 0;
+        }
+        if (s.count == 0 && !syscalls) {
+            continue;
+        }
+
+        if (s.count == 0) {
+            fprintf(out, "%s:\n", stats_stage_name(stage));
+        } else {
+            fprintf(out,
+                    "%s: %llu spans, wall %.3f ms, cpu %.3f ms, p50 < %.3f ms, p99 < %.3f ms, max %.3f ms, %llu bytes read\n",
+                    stats_stage_name(stage),
+                    (unsigned long long) s.count,
+                    s.wall_ns / 1e6,
+                    s.cpu_ns / 1e6,
+                    stats_percentile(&s, 0.50) / 1e6,
+                    stats_percentile(&s, 0.99) / 1e6,
+                    s.max_ns / 1e6,
+                    (unsigned long long) s.bytes_read);
+        }
+        if (syscalls) {
+            fprintf(out, "\tsyscalls:");
+            for (size_t i = 0; i < STATS_SYSCALL_COUNT; i++) {
+                if (s.syscalls[i]) {
+                    fprintf(out,
+                            " %s %llu",
+                            stats_syscall_name(i),
+                            (unsigned long long) s.syscalls[i]);
+                }
+            }
+            fputc('\n', out);
+        }
+    }
+
+    size_t count = 0;
+    LockSite** sites = collect_lock_sites(&count);
+    if (count) {
+        fprintf(out, "locks:\n");
+    }
+    for (size_t i = 0; i < count; i++) {
+        LockSite* site = sites[i];
+        fprintf(out,
+                "\t%s (%s:%d): %llu acquired, %llu contended, wait %.3f ms (max %.3f ms), hold %.3f ms (max %.3f ms)\n",
+                site->name,
+                site->file,
+                site->line,
+                (unsigned long long) site->count,
+                (unsigned long long) site->contended,
+                site->wait_ns / 1e6,
+                site->max_wait_ns / 1e6,
+                site->hold_ns / 1e6,
+                site->max_hold_ns / 1e6);
+    }
+    free(sites);
+}
+
+static void report_json(FILE* out) {
+    fprintf(out,
+            "{\"elapsed_ns\":%llu,\"stages\":{",
+            (unsigned long long) (stats_now() - started));
+    for (StatsStage stage = 0; stage < STATS_STAGE_COUNT; stage++) {
+        StageStats s;
+        stats_collect(stage, &s);
+
+        fprintf(out,
+                "%s\"%s\":{\"count\":%llu,\"wall_ns\":%llu,\"cpu_ns\":%llu,"
+                    "\"max_ns\":%llu,\"p50_ns\":%llu,\"p99_ns\":%llu,\"bytes_read\":%llu,"
+                    "\"syscalls\":{",
+                stage ? "," : "",
+                stats_stage_name(stage),
+                (unsigned long long) s.count,
+                (unsigned long long) s.wall_ns,
+                (unsigned long long) s.cpu_ns,
+                (unsigned long long) s.max_ns,
+                (unsigned long long) stats_percentile(&s, 0.50),
+                (unsigned long long) stats_percentile(&s, 0.99),
+                (unsigned long long) s.bytes_read);
+        for (size_t i = 0; i < STATS_SYSCALL_COUNT; i++) {
+            fprintf(out,
+                    "%s\"%s\":%llu",
+                    i ? "," : "",
+                    stats_syscall_name(i),
+                    (unsigned long long) s.syscalls[i]);
+        }
+        // histogram buckets are reported as [lower bound in ns, count]
+        fprintf(out, "},\"histogram\":[");
+        bool first = true;
+        for (size_t i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+            if (!s.histogram[i]) {
+                continue;
+            }
+            fprintf(out,
+                    "%s[%llu,%llu]",
+                    first ? "" : ",",
+                    i ? 1ULL << i : 0ULL,
+                    (unsigned long long) s.histogram[i]);
+            first = false;
+        }
+        fprintf(out, "]}");
+    }
+
+    fprintf(out, "},\"locks\":[");
+    size_t count = 0;
+    LockSite** sites = collect_lock_sites(&count);
+    for (size_t i = 0; i < count; i++) {
+        LockSite* site = sites[i];
+        fprintf(out,
+                "%s{\"name\":\"%s\",\"site\":\"%s:%d\",\"count\":%llu,\"contended\":%llu,"
+                    "\"wait_ns\":%llu,\"max_wait_ns\":%llu,\"hold_ns\":%llu,\"max_hold_ns\":%llu}",
+                i ? "," : "",
+                site->name,
+                site->file,
+                site->line,
+                (unsigned long long) site->count,
+                (unsigned long long) site->contended,
+                (unsigned long long) site->wait_ns,
+                (unsigned long long) site->max_wait_ns,
+                (unsigned long long) site->hold_ns,
+                (unsigned long long) site->max_hold_ns);
+    }
+    free(sites);
+    fprintf(out, "]}\n");
+}
+
+void stats_report(FILE* out, StatsFormat format) {
+    switch (format) {
+    case STATS_FORMAT_NONE:
+        break;
+    case STATS_FORMAT_TEXT:
+        report_text(out);
+        break;
+    case STATS_FORMAT_JSON:
+        report_json(out);
+        break;
+    }
+}
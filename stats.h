@@ -0,0 +1,234 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_STATS_H__
+#define __DEDUP_STATS_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "trace.h"
+
+/// Stats
+///
+/// Optional instrumentation of where time is spent. When enabled, each
+/// thread records the wall time, CPU time, and a latency histogram for each
+/// span of work, along with the number of syscalls made and bytes read while
+/// in a stage. Syscalls and reads are attributed to the innermost stage the
+/// thread is in.
+///
+/// Every thread records into its own `ThreadStats` block, so recording never
+/// contends with other threads. Blocks are only summed when a report is
+/// written, which must happen after all worker threads have been joined.
+///
+/// Spans are also written to the trace when tracing is enabled. When neither
+/// stats nor tracing are enabled every hook is a single predictable branch.
+
+typedef enum StatsStage {
+    STATS_NONE,
+    STATS_WALK,
+    STATS_PROBE,
+    STATS_HASH,
+    STATS_LOCK_WAIT,
+    STATS_DEDUPLICATE,
+    STATS_APPLY,
+    // the steps of replacing a file, nested within `STATS_APPLY`
+    STATS_APPLY_STAGE,
+    STATS_APPLY_CLONE,
+    STATS_APPLY_METADATA,
+    STATS_APPLY_RENAME,
+    STATS_APPLY_VERIFY,
+    STATS_STAGE_COUNT,
+} StatsStage;
+
+typedef enum StatsSyscall {
+    STATS_SYSCALL_OPEN,
+    STATS_SYSCALL_READ,
+    STATS_SYSCALL_MMAP,
+    STATS_SYSCALL_STAT,
+    STATS_SYSCALL_CLONE,
+    STATS_SYSCALL_COPYFILE,
+    STATS_SYSCALL_RENAME,
+    STATS_SYSCALL_UNLINK,
+    STATS_SYSCALL_LINK,
+    STATS_SYSCALL_COUNT,
+} StatsSyscall;
+
+typedef enum StatsFormat {
+    STATS_FORMAT_NONE,
+    STATS_FORMAT_TEXT,
+    STATS_FORMAT_JSON,
+} StatsFormat;
+
+/// Bucket `n` of a latency histogram counts spans which took at least
+/// 2^n and less than 2^(n+1) nanoseconds. The last bucket also counts
+/// anything longer.
+#define STATS_HISTOGRAM_BUCKETS 40
+
+typedef struct StageStats {
+    uint64_t count;
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+    uint64_t max_ns;
+    uint64_t bytes_read;
+    uint64_t syscalls[STATS_SYSCALL_COUNT];
+    uint64_t histogram[STATS_HISTOGRAM_BUCKETS];
+} StageStats;
+
+/// `name` and `size` are only used for tracing. If `name` is not set the
+/// stage name is used. `size` is omitted if it is negative.
+typedef struct StatsSpan {
+    StatsStage stage;
+    StatsStage previous;
+    uint64_t wall;
+    uint64_t cpu;
+    const char* name;
+    int64_t size;
+} StatsSpan;
+
+extern bool stats_enabled;
+
+/// Enables stats collection. Must be called before any other threads are
+/// started.
+void stats_enable();
+
+const char* stats_stage_name(StatsStage stage) __attribute__((const));
+const char* stats_syscall_name(StatsSyscall call) __attribute__((const));
+
+/// Clears everything recorded so far. Must not be called while other
+/// threads are recording.
+void stats_reset();
+
+/// Monotonic clock in nanoseconds.
+uint64_t stats_now();
+
+/// Begins a span of `stage` on the calling thread. Spans may be nested, the
+/// enclosing stage is restored when the span ends.
+StatsSpan stats_begin_span(StatsStage stage);
+void stats_end_span(StatsSpan* span);
+
+void stats_record_syscall(StatsSyscall call);
+void stats_record_read(uint64_t bytes);
+
+static inline StatsSpan stats_begin(StatsStage stage) {
+    if (!stats_enabled && !trace_enabled) {
+        return (StatsSpan) { 0 };
+    }
+    return stats_begin_span(stage);
+}
+
+static inline void stats_end(StatsSpan* span) {
+    if (span->stage != STATS_NONE) {
+        stats_end_span(span);
+    }
+}
+
+static inline void stats_syscall(StatsSyscall call) {
+    if (stats_enabled) {
+        stats_record_syscall(call);
+    }
+}
+
+static inline void stats_read(uint64_t bytes) {
+    if (stats_enabled) {
+        stats_record_read(bytes);
+    }
+}
+
+/// Lock Sites
+///
+/// Each place a mutex is locked with `STATS_LOCKED` has its own `LockSite`.
+/// When stats are enabled the site records how often it acquired the mutex,
+/// how often the mutex was already held by another thread, and how long it
+/// spent waiting for and holding the mutex. Time spent waiting for another
+/// thread is also recorded as a `STATS_LOCK_WAIT` span named after the
+/// mutex.
+///
+/// Sites are registered the first time they are used and are reported in
+/// the order of the most total time spent waiting.
+
+typedef struct LockSite {
+    const char* name;
+    const char* file;
+    int line;
+    atomic_bool registered;
+    _Atomic uint64_t count;
+    _Atomic uint64_t contended;
+    _Atomic uint64_t wait_ns;
+    _Atomic uint64_t max_wait_ns;
+    _Atomic uint64_t hold_ns;
+    _Atomic uint64_t max_hold_ns;
+    struct LockSite* next;
+} LockSite;
+
+typedef struct LockHold {
+    LockSite* site;
+    uint64_t acquired;
+} LockHold;
+
+LockHold stats_lock_site(LockSite* site, pthread_mutex_t* mutex);
+void stats_unlock_site(LockHold* hold, pthread_mutex_t* mutex);
+
+static inline LockHold stats_lock(LockSite* site, pthread_mutex_t* mutex) {
+    if (!stats_enabled && !trace_enabled) {
+        pthread_mutex_lock(mutex);
+        return (LockHold) { 0 };
+    }
+    return stats_lock_site(site, mutex);
+}
+
+static inline void stats_unlock(LockHold* hold, pthread_mutex_t* mutex) {
+    if (hold->site) {
+        stats_unlock_site(hold, mutex);
+    } else {
+        pthread_mutex_unlock(mutex);
+    }
+}
+
+/// Runs the statements that follow `label` with `mutex` held, recording the
+/// wait and hold times against this call site. The statements must not
+/// `return`, `break`, or `continue` out of the critical section.
+#define STATS_LOCKED(mutex, label, ...) do { \
+        static LockSite stats_site_ = { .name = (label), .file = __FILE__, .line = __LINE__ }; \
+        LockHold stats_hold_ = stats_lock(&stats_site_, (mutex)); \
+        __VA_ARGS__; \
+        stats_unlock(&stats_hold_, (mutex)); \
+    } while (0)
+
+/// Sums the stats from every thread for `stage` into `out`.
+void stats_collect(StatsStage stage, StageStats* out);
+
+/// Returns an upper bound, in nanoseconds, of the latency at `percentile`
+/// (0.0 - 1.0) as derived from the histogram in `s`.
+uint64_t stats_percentile(const StageStats* s, double percentile) __attribute__((pure));
+
+/// Writes a summary of all recorded stats to `out`.
+void stats_report(FILE* out, StatsFormat format);
+
+#endif // __DEDUP_STATS_H__
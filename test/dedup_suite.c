@@ -31,6 +31,7 @@
 #include <check.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "../utils.h"
@@ -179,6 +180,162 @@ START_TEST(dedup_dry_run) {
     ck_assert_int_eq(0, WEXITSTATUS(r));
 } END_TEST
 
+START_TEST(dedup_stats_json) {
+    char* output = run("../dedup -nP --stats=json test-data/clonefile/bars 2>&1 >/dev/null");
+    ck_assert_ptr_nonnull(strstr(output, "{\"elapsed_ns\":"));
+    ck_assert_ptr_nonnull(strstr(output, "\"probe\":{\"count\":5,"));
+    free(output);
+} END_TEST
+
+START_TEST(dedup_simulate) {
+    char* output = run("../dedup -P --simulate=files=1000,size=256:1024 /sim | tail -2");
+    ck_assert_str_eq("bytes saved: 1060864\n"
+                     "already saved: 0\n",
+                     output);
+    free(output);
+
+    int r = system("../dedup -P --simulate=size=1 /sim");
+    ck_assert_int_eq(1, WEXITSTATUS(r));
+} END_TEST
+
+START_TEST(dedup_deterministic) {
+    // the same origins are chosen no matter which thread visits a file
+    // first. only the count of duplicates found, which counts pairs as they
+    // are visited, may differ.
+    char* serial = run("../dedup -nP -t 0 --simulate=files=5000,size=256:40000,clones=30 /sim"
+                       " | tail -n +2");
+    char* parallel = run("../dedup -nP -t 4 --simulate=files=5000,size=256:40000,clones=30 /sim"
+                         " | tail -n +2");
+    ck_assert_str_eq(serial, parallel);
+    free(serial);
+    free(parallel);
+} END_TEST
+
+START_TEST(dedup_compare_limit) {
+    // comparing files byte by byte finds the same duplicates as hashing them
+    char* hashed = run("../dedup -nP -t 0 --compare-limit=0 --simulate=files=3000,size=256:100000,clones=30 /sim");
+    char* compared = run("../dedup -nP -t 0 --simulate=files=3000,size=256:100000,clones=30 /sim");
+    ck_assert_str_eq(hashed, compared);
+    free(hashed);
+    free(compared);
+} END_TEST
+
+START_TEST(dedup_probe_threads) {
+    // with probe threads, every file is probed on one of them rather than on
+    // a worker. the trace names the probe threads, so it is read twice
+    char* output = run("../dedup -nP -t 4 --probe-threads=8 --trace=test-data/probe.json --simulate=files=2000,size=256:100000,dup=40 /sim >/dev/null;"
+                       "awk '{ match($0, /\"tid\":[0-9]+/); tid = substr($0, RSTART + 6, RLENGTH - 6) }"
+                       " NR == FNR { if (/\"prober /) prober[tid] = 1; next }"
+                       " /\"name\":\"probe\"/ && tid in prober { n++ } END { print n+0 }'"
+                       " test-data/probe.json test-data/probe.json");
+    ck_assert_str_eq("2000\n", output);
+    free(output);
+    unlink("test-data/probe.json");
+} END_TEST
+
+START_TEST(dedup_parallel_apply) {
+    // the copies of an origin are cloned several at a time, so with latency
+    // some clones start before others have finished
+    char* output = run("../dedup -P -t 6 --trace=test-data/apply.json --simulate=files=500,size=256:100000,dup=40,clones=20,latency=200 /sim >/dev/null;"
+                       "awk '/\"name\":\"apply_clone\"/ { match($0, /\"ts\":[0-9.]+/); ts = substr($0, RSTART + 5, RLENGTH - 5);"
+                       " match($0, /\"dur\":[0-9.]+/); print ts, ts + substr($0, RSTART + 6, RLENGTH - 6) }' test-data/apply.json | sort -n |"
+                       "awk '{ if ($1 < end) overlapping++; if ($2 > end) end = $2 } END { print (overlapping > 0 ? \"concurrent\" : \"serial\") }'");
+    ck_assert_str_eq("concurrent\n", output);
+    free(output);
+    unlink("test-data/apply.json");
+} END_TEST
+
+START_TEST(dedup_rotational) {
+    // files on disks that seek are first opened in the order they are stored
+    char* output = run("../dedup -nP -t 4 --simulate=files=2000,size=256:100000,dup=40,clones=20,rotational=1,log=test-data/rotational.log /sim >/dev/null;"
+                       "awk '!seen[$4]++ { if ($3 < last) bad++; last = $3 } END { print bad+0 }' test-data/rotational.log");
+    ck_assert_str_eq("0\n", output);
+    free(output);
+
+    // and files no other file has the size of are not opened at all
+    output = run("../dedup -nP -t 4 --simulate=files=100,size=1:100000,dup=0,rotational=1,log=test-data/rotational.log /sim >/dev/null;"
+                 "wc -l < test-data/rotational.log | tr -d ' '");
+    ck_assert_str_eq("0\n", output);
+    free(output);
+    unlink("test-data/rotational.log");
+} END_TEST
+
+START_TEST(dedup_device_pools) {
+    // each device has its own pool of threads, so no thread opens files on
+    // more than one of them
+    char* output = run("../dedup -nP -t 4 --simulate=files=3000,size=256:100000,dup=40,clones=20,devices=3,log=test-data/devices.log /sim >/dev/null;"
+                       "awk '{ if (($1 in dev) && dev[$1] != $2) bad++; dev[$1] = $2; if (!seen[$2]++) devices++ } END { print bad+0, devices }' test-data/devices.log");
+    ck_assert_str_eq("0 3\n", output);
+    free(output);
+    unlink("test-data/devices.log");
+} END_TEST
+
+START_TEST(dedup_unmapped) {
+    // every file has distinct content, so files whose clone ids could not
+    // be read are compared instead of being taken to share extents
+    char* output = run("../dedup -P -t 0 --simulate=files=2000,size=64,dup=0,unmapped=100 /sim 2>/dev/null");
+    ck_assert_str_eq("duplicates found: 0\n"
+                     "bytes saved: 0\n"
+                     "already saved: 0\n",
+                     output);
+    free(output);
+
+    // and duplicates among them are found and replaced rather than taken to
+    // be clones of each other already
+    output = run("../dedup -P -t 0 --simulate=files=200,size=4096,dup=40,unmapped=100 /sim 2>/dev/null | tail -n 2");
+    ck_assert_str_eq("bytes saved: 299008\n"
+                     "already saved: 0\n",
+                     output);
+    free(output);
+} END_TEST
+
+START_TEST(dedup_encoded) {
+    // slices of one compressed extent all start where it does, which says
+    // nothing about their content, so distinct files are never one set
+    char* output = run("../dedup -nvP -t 0 --simulate=files=2000,size=20000,dup=0,encoded=100 /sim | grep -c 'already cloned'");
+    ck_assert_str_eq("0\n", output);
+    free(output);
+
+    // and duplicates among them are compared and replaced
+    output = run("../dedup -P -t 0 --simulate=files=2000,size=20000,dup=30,encoded=100 /sim | tail -n 2");
+    ck_assert_str_eq("bytes saved: 12718080\n"
+                     "already saved: 0\n",
+                     output);
+    free(output);
+} END_TEST
+
+START_TEST(dedup_many_copies) {
+    // more copies than are compared with each other are hashed instead, and
+    // the ones compared before that still end up in the same set
+    char* output = run("../dedup -nP -t 0 --simulate=files=40,size=20000,dup=100,extents=0 /sim"
+                       " | grep -c '^using'");
+    ck_assert_str_eq("1\n", output);
+    free(output);
+} END_TEST
+
+START_TEST(dedup_defragment) {
+    char* output = run("../dedup -P -t 0 --defragment=8 --simulate=files=1000,size=256:1024 /sim"
+                       " | grep -c '^.defragmented'");
+    ck_assert_str_eq("30\n", output);
+    free(output);
+
+    // savings are the same, only where the origins are stored changes
+    output = run("../dedup -P -t 0 --defragment=8 --simulate=files=1000,size=256:1024 /sim | tail -2");
+    ck_assert_str_eq("bytes saved: 1060864\n"
+                     "already saved: 0\n",
+                     output);
+    free(output);
+} END_TEST
+
+START_TEST(dedup_record_replay) {
+    char* recorded = run("../dedup -nP -t 0 --record-trace=test-data/bars.rec test-data/clonefile/bars");
+    char* replayed = run("../dedup -P -t 0 --replay=test-data/bars.rec");
+    unlink("test-data/bars.rec");
+    ck_assert_str_eq(recorded, replayed);
+    free(recorded);
+    free(replayed);
+} END_TEST
+
 #define ck_assert_timespec_eq(t1, t2) \
     ck_assert_msg(((t1).tv_sec == (t2).tv_sec && (t1).tv_nsec == (t2).tv_nsec), \
                   "Timespecs differ: %ld.%09ld != %ld.%09ld", \
@@ -277,6 +434,19 @@ Suite* dedup_suite() {
     tcase_add_test(tc, dedup_negative_threads);
     tcase_add_test(tc, dedup_help);
     tcase_add_test(tc, dedup_dry_run);
+    tcase_add_test(tc, dedup_stats_json);
+    tcase_add_test(tc, dedup_simulate);
+    tcase_add_test(tc, dedup_deterministic);
+    tcase_add_test(tc, dedup_compare_limit);
+    tcase_add_test(tc, dedup_probe_threads);
+    tcase_add_test(tc, dedup_parallel_apply);
+    tcase_add_test(tc, dedup_rotational);
+    tcase_add_test(tc, dedup_device_pools);
+    tcase_add_test(tc, dedup_unmapped);
+    tcase_add_test(tc, dedup_encoded);
+    tcase_add_test(tc, dedup_many_copies);
+    tcase_add_test(tc, dedup_defragment);
+    tcase_add_test(tc, dedup_record_replay);
     tcase_add_test(tc, dedup_preserve_mtime);
     tcase_add_test(tc, dedup_do_not_preserve_mtime);
     tcase_add_test(tc, dedup_preserve_mtime_relative_cwd);
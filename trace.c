@@ -0,0 +1,242 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "trace.h"
+
+/// Size of the blocks events are formatted into before being written.
+#define TRACE_TEXT_SIZE (16 * 1024)
+
+typedef struct TraceEvent {
+    const char* name;
+    uint64_t start;
+    uint64_t duration;
+    int64_t size;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+    size_t count;
+    uint32_t tid;
+    char name[32];
+    struct TraceBuffer* next;
+} TraceBuffer;
+
+typedef struct TraceText {
+    char data[TRACE_TEXT_SIZE];
+    size_t length;
+} TraceText;
+
+bool trace_enabled = false;
+
+static FILE* trace_file = NULL;
+static uint64_t trace_started = 0;
+static bool trace_first_event = true;
+static uint32_t trace_next_tid = 1;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t trace_key;
+static TraceBuffer* trace_buffers = NULL;
+static _Thread_local TraceBuffer* thread_buffer = NULL;
+
+static TraceBuffer* current_trace_buffer() {
+    if (!thread_buffer) {
+        thread_buffer = calloc(1, sizeof(TraceBuffer));
+        pthread_mutex_lock(&trace_mutex);
+        thread_buffer->tid = trace_next_tid++;
+        thread_buffer->next = trace_buffers;
+        trace_buffers = thread_buffer;
+        pthread_mutex_unlock(&trace_mutex);
+        pthread_setspecific(trace_key, thread_buffer);
+    }
+    return thread_buffer;
+}
+
+// every event is formatted with a leading separator, which the first one
+// in the file leaves out
+static void write_text(TraceText* text) {
+    const char* data = text->data;
+    size_t length = text->length;
+
+    pthread_mutex_lock(&trace_mutex);
+    if (length && trace_first_event) {
+        data += 2;
+        length -= 2;
+        trace_first_event = false;
+    }
+    fwrite(data, 1, length, trace_file);
+    pthread_mutex_unlock(&trace_mutex);
+
+    text->length = 0;
+}
+
+__attribute__((format(printf, 2, 3)))
+static void append_text(TraceText* text, const char* format, ...) {
+    // if the event does not fit, the block is written and it is retried
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t space = sizeof(text->data) - text->length;
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(text->data + text->length, space, format, args);
+        va_end(args);
+        if (n < 0) {
+            return;
+        }
+        if ((size_t) n < space) {
+            text->length += n;
+            return;
+        }
+        write_text(text);
+    }
+}
+
+// events are formatted without holding `trace_mutex`, which is only taken
+// to write each block of text. the name of the thread is written along
+// with its `last` events.
+static void flush_buffer(TraceBuffer* buffer, bool last) {
+    TraceText text;
+    text.length = 0;
+
+    for (size_t i = 0; i < buffer->count; i++) {
+        const TraceEvent* e = &buffer->events[i];
+        if (e->size >= 0) {
+            append_text(&text,
+                        ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"size\":%lld}}",
+                        e->name,
+                        buffer->tid,
+                        (e->start - trace_started) / 1e3,
+                        e->duration / 1e3,
+                        (long long) e->size);
+        } else {
+            append_text(&text,
+                        ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                        e->name,
+                        buffer->tid,
+                        (e->start - trace_started) / 1e3,
+                        e->duration / 1e3);
+        }
+    }
+    buffer->count = 0;
+
+    if (last && buffer->name[0]) {
+        append_text(&text,
+                    ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                    buffer->tid,
+                    buffer->name);
+    }
+    write_text(&text);
+}
+
+// writes and frees the buffer of a thread that is exiting
+static void retire_buffer(void* value) {
+    TraceBuffer* buffer = value;
+
+    pthread_mutex_lock(&trace_mutex);
+    TraceBuffer** link = &trace_buffers;
+    while (*link && *link != buffer) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = buffer->next;
+    }
+    pthread_mutex_unlock(&trace_mutex);
+
+    flush_buffer(buffer, true);
+    free(buffer);
+}
+
+int trace_open(const char* path) {
+    trace_file = fopen(path, "w");
+    if (!trace_file) {
+        return -1;
+    }
+    if (pthread_key_create(&trace_key, retire_buffer)) {
+        fclose(trace_file);
+        trace_file = NULL;
+        return -1;
+    }
+
+    trace_started = stats_now();
+    fputs("{\"traceEvents\":[\n", trace_file);
+    trace_enabled = true;
+    return 0;
+}
+
+void trace_close() {
+    if (!trace_file) {
+        return;
+    }
+    trace_enabled = false;
+
+    // every other thread has exited and written its own buffer
+    pthread_mutex_lock(&trace_mutex);
+    TraceBuffer* buffer = trace_buffers;
+    trace_buffers = NULL;
+    pthread_mutex_unlock(&trace_mutex);
+
+    while (buffer) {
+        TraceBuffer* next = buffer->next;
+        flush_buffer(buffer, true);
+        free(buffer);
+        buffer = next;
+    }
+
+    // the calling thread's buffer has been freed with the rest
+    thread_buffer = NULL;
+    pthread_setspecific(trace_key, NULL);
+    pthread_key_delete(trace_key);
+
+    fputs("\n]}\n", trace_file);
+    fclose(trace_file);
+    trace_file = NULL;
+}
+
+void trace_thread_name(const char* name) {
+    if (!trace_enabled) {
+        return;
+    }
+    TraceBuffer* buffer = current_trace_buffer();
+    strlcpy(buffer->name, name, sizeof(buffer->name));
+}
+
+void trace_event(const char* name, uint64_t start_ns, uint64_t duration_ns, int64_t size) {
+    TraceBuffer* buffer = current_trace_buffer();
+    if (buffer->count == TRACE_BUFFER_EVENTS) {
+        flush_buffer(buffer, false);
+    }
+
+    buffer->events[buffer->count++] = (TraceEvent) {
+        .name = name,
+        .start = start_ns,
+        .duration = duration_ns,
+        .size = size,
+    };
+}
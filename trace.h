@@ -0,0 +1,67 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_TRACE_H__
+#define __DEDUP_TRACE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Trace
+///
+/// Writes spans in the Chrome trace event format, which can be loaded in
+/// Perfetto or `chrome://tracing` to see what each thread was doing over
+/// time.
+///
+/// Each thread appends events to its own fixed size buffer without taking
+/// any locks. When a buffer fills, the owning thread formats it and writes
+/// it to the trace file (the only time a lock is taken, for each block of
+/// text) and starts over. A thread's buffer is written and freed when the
+/// thread exits, so a trace can be left on for an entire run with memory
+/// use bounded by the number of running threads.
+
+/// Number of events each thread buffers before writing to the trace file.
+#define TRACE_BUFFER_EVENTS 4096
+
+extern bool trace_enabled;
+
+/// Opens `path` for writing and enables tracing. Must be called before any
+/// other threads are started. Returns 0 on success.
+int trace_open(const char* path);
+
+/// Writes all buffered events and closes the trace file. Must be called
+/// after all other threads that recorded events have exited.
+void trace_close();
+
+/// Names the calling thread in the trace.
+void trace_thread_name(const char* name);
+
+/// Records a complete event named `name` which started at `start_ns` (from
+/// `stats_now`) and lasted `duration_ns`. `size` is included as an argument
+/// if it is not negative. `name` must be a string constant.
+void trace_event(const char* name, uint64_t start_ns, uint64_t duration_ns, int64_t size);
+
+#endif // __DEDUP_TRACE_H__
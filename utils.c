@@ -25,80 +25,88 @@
 // SPDX-License-Identifier: BSD-2-Clause
 
 #include <sys/attr.h>
+#include <sys/stat.h>
 
 #include <err.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "record.h"
+#include "stats.h"
 #include "utils.h"
-
-#define ATTR_BITMAP_COUNT 5
+#include "vfs.h"
 
 uint64_t get_clone_id(const char* restrict path) {
-    struct attrlist attrList = {
-        .bitmapcount = ATTR_BITMAP_COUNT,
-        .forkattr = ATTR_CMNEXT_CLONEID,
-    };
+    uint64_t clone_id = 0;
 
-    struct UInt64Ref {
-        uint32_t length;
-        uint64_t value;
-    } __attribute((aligned(4), packed));
-    struct UInt64Ref clone_id = { 0 };
-
-    int err = getattrlist(path, &attrList, &clone_id, sizeof(struct UInt64Ref), FSOPT_ATTR_CMN_EXTENDED);
+    stats_syscall(STATS_SYSCALL_STAT);
+    int err = vfs->clone_id(path, &clone_id);
     if (err) {
         warnx("%s:%i %s", __FUNCTION__, __LINE__, path);
         perror("could not getattrlist");
         return 0;
     }
 
-    return clone_id.value;
+    return clone_id;
 }
 
 int may_share_blocks(const char* restrict path) {
-    struct attrlist attrList = {
-        .bitmapcount = ATTR_BITMAP_COUNT,
-        .forkattr = ATTR_CMNEXT_EXT_FLAGS,
-    };
+    uint64_t flags = 0;
 
-    struct UInt64Ref {
-        uint32_t length;
-        uint64_t value;
-    } __attribute((aligned(4), packed));
-    struct UInt64Ref clone_id = { 0 };
-
-    int err = getattrlist(path, &attrList, &clone_id, sizeof(struct UInt64Ref), FSOPT_ATTR_CMN_EXTENDED);
+    stats_syscall(STATS_SYSCALL_STAT);
+    int err = vfs->ext_flags(path, &flags);
     if (err) {
         warnx("%s:%i %s", __FUNCTION__, __LINE__, path);
         perror("could not getattrlist");
         return 0;
     }
 
-    return clone_id.value | EF_MAY_SHARE_BLOCKS;
+    return flags | EF_MAY_SHARE_BLOCKS;
 }
 
 size_t private_size(const char* restrict path) {
-    struct attrlist attrList = {
-        .bitmapcount = ATTR_BITMAP_COUNT,
-        .forkattr = ATTR_CMNEXT_PRIVATESIZE,
-    };
+    off_t size = 0;
 
-    struct UInt64Ref {
-        uint32_t length;
-        off_t size;
-    } __attribute((aligned(4), packed));
-    struct UInt64Ref size_attr = { 0 };
-
-    int err = getattrlist(path, &attrList, &size_attr, sizeof(struct UInt64Ref), FSOPT_ATTR_CMN_EXTENDED);
+    stats_syscall(STATS_SYSCALL_STAT);
+    int err = vfs->private_size(path, &size);
     if (err) {
         warnx("%s:%i %s", __FUNCTION__, __LINE__, path);
         perror("could not getattrlist");
         return 0;
     }
 
-    return size_attr.size;
+    return size;
+}
+
+size_t allocated_size(const char* restrict path) {
+    struct stat st;
+
+    stats_syscall(STATS_SYSCALL_STAT);
+    if (vfs->stat(path, &st)) {
+        warn("%s", path);
+        return 0;
+    }
+
+    return (size_t) st.st_blocks * 512;
+}
+
+size_t shared_size(const char* restrict path) {
+    size_t allocated = allocated_size(path),
+           unshared = private_size(path);
+    return allocated > unshared ? allocated - unshared : 0;
+}
+
+size_t fragment_count(const char* restrict path) {
+    size_t fragments = 0;
+
+    stats_syscall(STATS_SYSCALL_STAT);
+    if (vfs->fragments(path, &fragments)) {
+        warn("%s", path);
+        return SIZE_MAX;
+    }
+
+    return fragments;
 }
 
 FileMetadata* metadata_from_entry(FileEntry* fe) {
@@ -123,54 +131,53 @@ FileMetadata* metadata_from_entry(FileEntry* fe) {
     // first and last characters
     //
 
-    FILE* f = fopen(fe->path, "r");
-    if (!f) {
-        /*
-        PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
-            clear_progress();
-            fprintf(stderr, "failed to open %s\n", fm->path);
-            perror("open(2)");
-        });
-        */
+    stats_syscall(STATS_SYSCALL_OPEN);
+    int fd = vfs->open(fe->path);
+    if (fd < 0) {
         return NULL;
     }
 
-    int c = fgetc(f);
-    if (c < 0) {
-        /*
-        PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
-            fprintf(stderr, "failed read first byte %s\n", fm.path);
-            perror("fgetc(3)");
-        });
-        */
-        return NULL;
-    }
-    fm.first = c;
-
-    if (fseek(f, -1, SEEK_END) < 0) {
-        /*
-        PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
-            fprintf(stderr, "failed seek %s\n", fm.path);
-            perror("fseek(3)");
-        });
-        */
-        return NULL;
+    // small files are read in a single call. backends that provide digests
+    // without reading anything are left to do so.
+    unsigned char small[SMALL_FILE_SIZE];
+    bool whole = !vfs->digest && fe->size <= SMALL_FILE_SIZE;
+    if (whole) {
+        stats_syscall(STATS_SYSCALL_READ);
+        ssize_t r = vfs->pread(fd, small, fe->size, 0);
+        vfs->close(fd);
+        if (r <= 0 || (size_t) r != fe->size) {
+            return NULL;
+        }
+        stats_read(r);
+
+        fm.first = small[0];
+        fm.last = small[r - 1];
+    } else {
+        // the last byte is requested before the first is read so both
+        // reads are outstanding together
+        if (vfs->advise) {
+            vfs->advise(fd, fe->size - 1, 1);
+        }
+
+        unsigned char c = 0;
+        stats_syscall(STATS_SYSCALL_READ);
+        if (vfs->pread(fd, &c, 1, 0) != 1) {
+            vfs->close(fd);
+            return NULL;
+        }
+        fm.first = c;
+
+        stats_syscall(STATS_SYSCALL_READ);
+        if (vfs->pread(fd, &c, 1, fe->size - 1) != 1) {
+            vfs->close(fd);
+            return NULL;
+        }
+        vfs->close(fd);
+        stats_read(2);
+
+        fm.last = c;
     }
 
-    c = fgetc(f);
-    if (c < 0) {
-        /*
-        PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
-            fprintf(stderr, "failed read last byte %s\n", fm.path);
-            perror("fgetc(3)");
-        });
-        */
-        return NULL;
-    }
-    fclose(f);
-
-    fm.last = c;
-
     //
     // file real path
     //
@@ -181,7 +188,25 @@ FileMetadata* metadata_from_entry(FileEntry* fe) {
     // get clone id
     //
 
+    // an unknown clone id is left 0, which no other file is treated as
+    // sharing extents with
     fm.clone_id = get_clone_id(fe->path);
 
+    if (record_enabled) {
+        // sizes are only needed to account for savings, which replays
+        // cannot measure themselves
+        record_probe(fm.device,
+                     fm.inode,
+                     fm.first,
+                     fm.last,
+                     fm.clone_id,
+                     allocated_size(fe->path),
+                     private_size(fe->path));
+    }
+
+    if (whole) {
+        populate_sha256_from_buffer(&fm, small);
+    }
+
     return metadata_dup(&fm);
 }
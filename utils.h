@@ -31,13 +31,34 @@
 #include "map.h"
 #include "queue.h"
 
+/// Files up to this size are read whole while they are probed and their
+/// digest is computed then, instead of being opened and mapped again if
+/// another file with the same size, first, and last byte is found. For
+/// files this small the extra syscalls cost more than hashing does.
+#define SMALL_FILE_SIZE (16 * 1024)
+
 /// return the clone id associated with the file at `path`.
 /// two files with the same clone id share blocks, however,
 /// two files may share blocks but have different clone ids.
+/// returns 0 if it cannot be read, which is never the clone id of a file.
 uint64_t get_clone_id(const char* restrict path);
 int may_share_blocks(const char* restrict path);
 size_t private_size(const char* restrict path);
 
+/// return the number of bytes allocated to the file at `path`
+/// (`st_blocks`), including any shared with other files. sparse
+/// regions are not allocated.
+size_t allocated_size(const char* restrict path);
+
+/// return the number of bytes allocated to the file at `path` which
+/// are shared with other files, i.e. the space that is already saved.
+size_t shared_size(const char* restrict path);
+
+/// return the number of physically contiguous runs the data of the
+/// file at `path` is stored in, or `SIZE_MAX` if it cannot be
+/// determined.
+size_t fragment_count(const char* restrict path);
+
 FileMetadata* metadata_from_entry(FileEntry* fe) ATTR_MALLOC(free_metadata, 1);
 
 #endif // __DEDUP_UTIL_H__
@@ -0,0 +1,817 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#if defined(__APPLE__)
+#include <sys/attr.h>
+#include <sys/clonefile.h>
+#include <copyfile.h>
+#include <sys/disk.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#elif defined(__linux__)
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <linux/magic.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <sys/vfs.h>
+#endif
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__FREEBSD__)
+#include <sys/ioctl.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vfs.h"
+
+#define ATTR_BITMAP_COUNT 5
+
+#ifdef DEBUG
+#define COPYFILE_DEBUG (1<<31)
+#else
+#define COPYFILE_DEBUG (0)
+#endif
+
+const Vfs* vfs = &VFS_NATIVE;
+
+struct VfsWalk {
+    FTS* fts;
+    FTSENT* current;
+};
+
+static VfsWalk* native_walk_open(char* const* paths, int fts_options) {
+    FTS* fts = fts_open(paths, fts_options, NULL);
+    if (!fts) {
+        return NULL;
+    }
+
+    VfsWalk* walk = calloc(1, sizeof(VfsWalk));
+    walk->fts = fts;
+    return walk;
+}
+
+static bool native_walk_next(VfsWalk* walk, VfsEntry* entry) {
+    FTSENT* e = fts_read(walk->fts);
+    walk->current = e;
+    if (!e) {
+        return false;
+    }
+
+    *entry = (VfsEntry) {
+        .path = e->fts_path,
+        .info = e->fts_info,
+        .error = e->fts_errno,
+        .level = e->fts_level,
+    };
+    if (e->fts_statp) {
+        entry->device = e->fts_statp->st_dev;
+        entry->inode = e->fts_statp->st_ino;
+        entry->nlink = e->fts_statp->st_nlink;
+#if defined(__APPLE__) || defined(__FREEBSD__)
+        entry->flags = e->fts_statp->st_flags;
+#endif
+        entry->size = e->fts_statp->st_size;
+    }
+    return true;
+}
+
+static void native_walk_skip(VfsWalk* walk) {
+    if (walk->current) {
+        fts_set(walk->fts, walk->current, FTS_SKIP);
+    }
+}
+
+static void native_walk_close(VfsWalk* walk) {
+    fts_close(walk->fts);
+    free(walk);
+}
+
+static int native_open(const char* path) {
+    return open(path, O_RDONLY);
+}
+
+static ssize_t native_pread(int fd, void* buffer, size_t size, off_t offset) {
+    return pread(fd, buffer, size, offset);
+}
+
+static void native_advise(int fd, off_t offset, size_t size) {
+#if defined(__APPLE__)
+    struct radvisory ra = {
+        .ra_offset = offset,
+        .ra_count = size > INT_MAX ? INT_MAX : (int) size,
+    };
+    fcntl(fd, F_RDADVISE, &ra);
+#else
+    posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+#endif
+}
+
+static void* native_map(int fd, size_t size) {
+    void* buffer = mmap((caddr_t) 0,
+                        size,
+                        PROT_READ,
+                        MAP_PRIVATE,
+                        fd,
+                        0);
+    return buffer == MAP_FAILED ? NULL : buffer;
+}
+
+static void native_unmap(void* buffer, size_t size) {
+    munmap(buffer, size);
+}
+
+static void native_close(int fd) {
+    close(fd);
+}
+
+static int native_stat(const char* path, struct stat* st) {
+    return stat(path, st);
+}
+
+// physical locations of extents with these flags are unknown, or are not
+// unique to the data in the extent. encoded (e.g. compressed) extents are
+// located by where the whole extent starts, even for a file that only uses
+// a slice of it.
+#define FIEMAP_EXTENT_UNSTABLE \
+    (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | \
+     FIEMAP_EXTENT_ENCODED | FIEMAP_EXTENT_DATA_ENCRYPTED | \
+     FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_DATA_TAIL | \
+     FIEMAP_EXTENT_NOT_ALIGNED)
+
+static uint64_t mix(uint64_t z) {
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+uint64_t extent_identity_start(dev_t device, off_t size) {
+    return mix(device ^ mix(size));
+}
+
+bool extent_identity_add(uint64_t* identity, const VfsExtent* extent) {
+    // unwritten (preallocated) extents read as zeros regardless of what is
+    // on disk
+    uint64_t unwritten = extent->flags & FIEMAP_EXTENT_UNWRITTEN;
+    *identity = mix(*identity ^
+                    mix(extent->logical ^
+                        mix(extent->physical ^
+                            mix(extent->length ^ unwritten))));
+    return !(extent->flags & FIEMAP_EXTENT_UNSTABLE);
+}
+
+#if defined(__APPLE__)
+
+static int get_fork_attr(const char* path, attrgroup_t attr, uint64_t* out) {
+    struct attrlist attrList = {
+        .bitmapcount = ATTR_BITMAP_COUNT,
+        .forkattr = attr,
+    };
+
+    struct UInt64Ref {
+        uint32_t length;
+        uint64_t value;
+    } __attribute((aligned(4), packed));
+    struct UInt64Ref value = { 0 };
+
+    int err = getattrlist(path, &attrList, &value, sizeof(struct UInt64Ref), FSOPT_ATTR_CMN_EXTENDED);
+    if (err) {
+        return err;
+    }
+
+    *out = value.value;
+    return 0;
+}
+
+static int native_clone_id(const char* path, uint64_t* clone_id) {
+    return get_fork_attr(path, ATTR_CMNEXT_CLONEID, clone_id);
+}
+
+static int native_private_size(const char* path, off_t* size) {
+    uint64_t value = 0;
+    int err = get_fork_attr(path, ATTR_CMNEXT_PRIVATESIZE, &value);
+    *size = value;
+    return err;
+}
+
+static int native_ext_flags(const char* path, uint64_t* flags) {
+    return get_fork_attr(path, ATTR_CMNEXT_EXT_FLAGS, flags);
+}
+
+// walks the file with F_LOG2PHYS_EXT, which returns the physical location
+// of a file offset and how many bytes are contiguous from there
+static int native_fragments(const char* path, size_t* fragments) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return -1;
+    }
+
+    *fragments = 0;
+    off_t offset = 0, next_physical = 0;
+    while (offset < st.st_size) {
+        struct log2phys l2p = {
+            .l2p_contigbytes = st.st_size - offset,
+            .l2p_devoffset = offset,
+        };
+        if (fcntl(fd, F_LOG2PHYS_EXT, &l2p) == -1) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+        // inline data has no physical location
+        if (l2p.l2p_contigbytes <= 0) {
+            break;
+        }
+
+        if (*fragments == 0 || l2p.l2p_devoffset != next_physical) {
+            (*fragments)++;
+        }
+        next_physical = l2p.l2p_devoffset + l2p.l2p_contigbytes;
+        offset += l2p.l2p_contigbytes;
+    }
+
+    close(fd);
+    return 0;
+}
+
+static int native_physical_offset(const char* path, uint64_t* offset) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct log2phys l2p = {
+        .l2p_contigbytes = 1,
+        .l2p_devoffset = 0,
+    };
+    int result = fcntl(fd, F_LOG2PHYS_EXT, &l2p);
+    int errno_saved = errno;
+    close(fd);
+    errno = errno_saved;
+    if (result == -1) {
+        return -1;
+    }
+
+    *offset = l2p.l2p_devoffset;
+    return 0;
+}
+
+static bool native_rotational(const char* path) {
+    struct statfs stat_buf;
+    if (statfs(path, &stat_buf)) {
+        return false;
+    }
+
+    // opening the device may take more privileges than reading the files on
+    // it, in which case it is assumed not to seek
+    int fd = open(stat_buf.f_mntfromname, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    uint32_t solid_state = 1;
+    int result = ioctl(fd, DKIOCISSOLIDSTATE, &solid_state);
+    close(fd);
+    return !result && !solid_state;
+}
+
+static bool is_vol_cap_supported(const char* path, int vol_cap) {
+    struct VolAttrsBuf {
+        u_int32_t length;
+        vol_capabilities_attr_t capabilities;
+        vol_attributes_attr_t attributes;
+    } __attribute__((aligned(4), packed));
+    struct VolAttrsBuf vol_attrs;
+
+    struct attrlist attr_list = {
+        .bitmapcount = ATTR_BIT_MAP_COUNT,
+        .volattr = ATTR_VOL_INFO | ATTR_VOL_CAPABILITIES | ATTR_VOL_ATTRIBUTES,
+    };
+    // get the file system's mount point path for the input path
+    struct statfs stat_buf;
+    int result = statfs(path, &stat_buf);
+
+    if (result) {
+        perror("Could not get volume stat");
+        // TODO: exit?
+        return false;
+    }
+
+    // get the supported capabilities and attributes
+    result = getattrlist(stat_buf.f_mntonname,
+                         &attr_list,
+                         &vol_attrs,
+                         sizeof(vol_attrs),
+                         FSOPT_ATTR_CMN_EXTENDED);
+    if (result) {
+        perror("Could not retrieve volume attributes");
+        // TODO: exit?
+        return false;
+    }
+
+     #define VOL_CAPABILITIES_FORMAT     0
+     #define VOL_CAPABILITIES_INTERFACES 1
+     #define VOL_CAPABILITIES_RESERVED1  2
+     #define VOL_CAPABILITIES_RESERVED2  3
+
+    return vol_attrs.capabilities.capabilities[VOL_CAPABILITIES_INTERFACES] & vol_cap;
+}
+
+static bool native_clone_supported(const char* path) {
+    return is_vol_cap_supported(path, VOL_CAP_INT_CLONE);
+}
+
+#elif defined(__linux__)
+
+// from <sys/attr.h>
+#define EF_MAY_SHARE_BLOCKS 0x00000001
+
+// extents are read from FS_IOC_FIEMAP this many at a time
+#define FIEMAP_BATCH 256
+
+/// btrfs and XFS do not have clone ids, but a file which shares all of its
+/// data with another maps to the same physical extents. `identity` is a hash
+/// of the device, size, and extent map, so files with the same identity have
+/// the same content. Files whose extents do not identify their data (e.g.
+/// slices of compressed extents) get an identity of 0, the unknown clone id,
+/// so they are read and compared like any other file. `fragments` is
+/// the number of physically contiguous runs the extents form, the first of
+/// which starts at `physical_offset`.
+typedef struct ExtentMap {
+    uint64_t identity;
+    off_t private_size;
+    size_t fragments;
+    uint64_t physical_offset;
+    bool shared;
+} ExtentMap;
+
+static int get_extent_map(const char* path, ExtentMap* out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return -1;
+    }
+
+    struct fiemap* map = calloc(1, sizeof(struct fiemap) + FIEMAP_BATCH * sizeof(struct fiemap_extent));
+    *out = (ExtentMap) { .identity = extent_identity_start(st.st_dev, st.st_size) };
+
+    bool stable = true, last = false;
+    size_t extents = 0;
+    uint64_t start = 0, next_physical = 0;
+    while (!last) {
+        map->fm_start = start;
+        map->fm_length = FIEMAP_MAX_OFFSET - start;
+        map->fm_flags = FIEMAP_FLAG_SYNC;
+        map->fm_extent_count = FIEMAP_BATCH;
+        map->fm_mapped_extents = 0;
+
+        if (ioctl(fd, FS_IOC_FIEMAP, map)) {
+            int saved = errno;
+            free(map);
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+
+        if (map->fm_mapped_extents == 0) {
+            break;
+        }
+
+        for (uint32_t i = 0; i < map->fm_mapped_extents; i++) {
+            const struct fiemap_extent* e = &map->fm_extents[i];
+            if (e->fe_flags & FIEMAP_EXTENT_SHARED) {
+                out->shared = true;
+            } else {
+                out->private_size += e->fe_length;
+            }
+
+            VfsExtent extent = {
+                .logical = e->fe_logical,
+                .physical = e->fe_physical,
+                .length = e->fe_length,
+                .flags = e->fe_flags,
+            };
+            stable &= extent_identity_add(&out->identity, &extent);
+
+            if (extents == 0) {
+                out->physical_offset = e->fe_physical;
+            }
+            if (extents == 0 || e->fe_physical != next_physical) {
+                out->fragments++;
+            }
+            next_physical = e->fe_physical + e->fe_length;
+
+            extents++;
+            start = e->fe_logical + e->fe_length;
+            last = e->fe_flags & FIEMAP_EXTENT_LAST;
+        }
+    }
+    free(map);
+    close(fd);
+
+    if (!stable || extents == 0) {
+        out->identity = 0;
+    }
+    return 0;
+}
+
+static int native_clone_id(const char* path, uint64_t* clone_id) {
+    ExtentMap map = { 0 };
+    int err = get_extent_map(path, &map);
+    // on failure the identity is only a digest of the device and size
+    *clone_id = err ? 0 : map.identity;
+    return err;
+}
+
+static int native_private_size(const char* path, off_t* size) {
+    ExtentMap map = { 0 };
+    int err = get_extent_map(path, &map);
+    *size = map.private_size;
+    return err;
+}
+
+static int native_ext_flags(const char* path, uint64_t* flags) {
+    ExtentMap map = { 0 };
+    int err = get_extent_map(path, &map);
+    *flags = map.shared ? EF_MAY_SHARE_BLOCKS : 0;
+    return err;
+}
+
+static int native_fragments(const char* path, size_t* fragments) {
+    ExtentMap map = { 0 };
+    int err = get_extent_map(path, &map);
+    *fragments = map.fragments;
+    return err;
+}
+
+static int native_physical_offset(const char* path, uint64_t* offset) {
+    ExtentMap map = { 0 };
+    if (get_extent_map(path, &map)) {
+        return -1;
+    }
+    if (map.fragments == 0) {
+        errno = ENODATA;
+        return -1;
+    }
+    *offset = map.physical_offset;
+    return 0;
+}
+
+static bool native_rotational(const char* path) {
+    struct stat st;
+    if (stat(path, &st)) {
+        return false;
+    }
+
+    // partitions have no queue of their own, the disk they are on is one
+    // level up. filesystems without a block device (e.g. btrfs, NFS) have
+    // neither.
+    static const char* const QUEUES[] = {
+        "/sys/dev/block/%u:%u/queue/rotational",
+        "/sys/dev/block/%u:%u/../queue/rotational",
+    };
+    for (size_t i = 0; i < sizeof(QUEUES) / sizeof(QUEUES[0]); i++) {
+        char queue[PATH_MAX];
+        snprintf(queue, sizeof(queue), QUEUES[i], major(st.st_dev), minor(st.st_dev));
+        FILE* f = fopen(queue, "r");
+        if (f) {
+            int c = fgetc(f);
+            fclose(f);
+            return c == '1';
+        }
+    }
+    return false;
+}
+
+static bool native_clone_supported(const char* path) {
+    struct statfs stat_buf;
+    if (statfs(path, &stat_buf)) {
+        perror("Could not get volume stat");
+        return false;
+    }
+
+    switch (stat_buf.f_type) {
+    case BTRFS_SUPER_MAGIC:
+    case XFS_SUPER_MAGIC:
+        return true;
+    default:
+        return false;
+    }
+}
+
+#else
+#error Operating system not supported
+#endif
+
+static char* native_realpath(const char* path) {
+    return realpath(path, NULL);
+}
+
+static int native_clone(const char* src, const char* dst) {
+#if defined(__APPLE__)
+    return clonefile(src, dst, 0);
+#elif defined(__FREEBSD__)
+    // n.b.! This is completely untested and probably erases
+    //       everything it touches. There are currently no
+    //       equivalents to volume capability checks on the
+    //       frontend, so it's not even clear that the files
+    //       that are being passed in here are on a partition
+    //       that can be cloned.
+    int src_fd = open(src, O_RDONLY);
+    if (src_fd < 0) {
+        perror("open(2) failed");
+        return errno;
+    }
+    int dst_fd = open(dst, O_WRONLY | O_CREAT | O_EXCL);
+    if (dst_fd < 0) {
+        close(src_fd);
+        perror("open(2) failed");
+        return errno;
+    }
+    int result = ioctl(dst_fd, CF_FICLONE, src_fd);
+    int errno_saved = errno;
+    close(src_fd);
+    close(dst_fd);
+    errno = errno_saved;
+    return result;
+#elif defined(__linux__)
+    int src_fd = open(src, O_RDONLY);
+    if (src_fd < 0) {
+        return -1;
+    }
+    int dst_fd = open(dst, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (dst_fd < 0) {
+        int errno_saved = errno;
+        close(src_fd);
+        errno = errno_saved;
+        return -1;
+    }
+    int result = ioctl(dst_fd, FICLONE, src_fd);
+    int errno_saved = errno;
+    close(src_fd);
+    close(dst_fd);
+    errno = errno_saved;
+    return result;
+#else
+#error Operating system not supported.
+#endif
+}
+
+// reserves `size` bytes for `fd` before anything is written, so the
+// allocator can place them in as few runs as possible
+static int preallocate(int fd, off_t size) {
+#if defined(__APPLE__)
+    fstore_t store = {
+        .fst_flags = F_ALLOCATECONTIG | F_ALLOCATEALL,
+        .fst_posmode = F_PEOFPOSMODE,
+        .fst_offset = 0,
+        .fst_length = size,
+    };
+    return fcntl(fd, F_PREALLOCATE, &store) == -1 ? -1 : 0;
+#elif defined(__linux__)
+    int result = posix_fallocate(fd, 0, size);
+    if (result) {
+        errno = result;
+        return -1;
+    }
+    return 0;
+#else
+#error Operating system not supported
+#endif
+}
+
+#define COPY_BUFFER_SIZE (1024 * 1024)
+
+static int native_copy_contiguous(const char* src, const char* dst) {
+    int src_fd = open(src, O_RDONLY);
+    if (src_fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(src_fd, &st)) {
+        int errno_saved = errno;
+        close(src_fd);
+        errno = errno_saved;
+        return -1;
+    }
+
+    int dst_fd = open(dst, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (dst_fd < 0) {
+        int errno_saved = errno;
+        close(src_fd);
+        errno = errno_saved;
+        return -1;
+    }
+
+    char* buffer = malloc(COPY_BUFFER_SIZE);
+    int result = buffer ? preallocate(dst_fd, st.st_size) : -1;
+
+    for (off_t offset = 0; !result && offset < st.st_size;) {
+        ssize_t r = pread(src_fd, buffer, COPY_BUFFER_SIZE, offset);
+        if (r <= 0) {
+            if (r == 0) {
+                // the file was truncated while being copied
+                errno = EIO;
+            }
+            result = -1;
+            break;
+        }
+        for (ssize_t written = 0; written < r;) {
+            ssize_t w = pwrite(dst_fd, buffer + written, r - written, offset + written);
+            if (w < 0) {
+                result = -1;
+                break;
+            }
+            written += w;
+        }
+        offset += r;
+    }
+
+    if (!result) {
+#if defined(__APPLE__)
+        struct timespec times[2] = { st.st_atimespec, st.st_mtimespec };
+#else
+        struct timespec times[2] = { st.st_atim, st.st_mtim };
+#endif
+        result = fsync(dst_fd) || futimens(dst_fd, times) ? -1 : 0;
+    }
+
+    int errno_saved = errno;
+    free(buffer);
+    close(src_fd);
+    close(dst_fd);
+    errno = errno_saved;
+    return result;
+}
+
+static int native_copy_metadata(const char* src, const char* dst, bool check) {
+#if defined(__APPLE__)
+    return copyfile(src,
+                    dst,
+                    NULL,
+                    check
+                        ? COPYFILE_CHECK | COPYFILE_METADATA
+                        : COPYFILE_METADATA | COPYFILE_DEBUG);
+#elif defined(__linux__)
+    // only the mode and owner are copied, which never includes data
+    if (check) {
+        return 0;
+    }
+
+    struct stat st;
+    if (stat(src, &st) || chmod(dst, st.st_mode & 07777)) {
+        return -1;
+    }
+    // only root can give a file away
+    if (chown(dst, st.st_uid, st.st_gid) && errno != EPERM) {
+        return -1;
+    }
+    return 0;
+#else
+#error Operating system not supported
+#endif
+}
+
+// get the parent directory mtime and return it and a file descriptor
+// for the directory. if return is 0, caller is responsible for closing
+// the returned fd
+static int native_parent_mtime(const char* path, int* fd_out, struct timespec* mtime_out) {
+    char buffer[PATH_MAX] = { 0 };
+#if defined(__APPLE__)
+    char* parent = dirname_r(path, buffer);
+#else
+    snprintf(buffer, sizeof(buffer), "%s", path);
+    char* parent = dirname(buffer);
+#endif
+    if (!parent) {
+        perror("dirname_r");
+        return -1;
+    }
+
+    int fd = open(parent, O_RDONLY);
+    if (fd == -1) {
+        perror("open parent dir");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat parent dir");
+        close(fd);
+        return -1;
+    }
+
+    *fd_out = fd;
+#if defined(__APPLE__)
+    *mtime_out = st.st_mtimespec;
+#else
+    *mtime_out = st.st_mtim;
+#endif
+    return 0;
+}
+
+// restore the provided mtime to the provided fd. fd is closed
+// before the function returns
+static void native_restore_parent_mtime(int fd, struct timespec mtime) {
+    struct timespec times[2] = {
+        // omit atime
+        { .tv_sec = 0, .tv_nsec = UTIME_OMIT },
+        mtime,
+    };
+    if (futimens(fd, times) == -1) {
+        switch (errno) {
+        case EPERM:
+            fprintf(stderr, "Warning: cannot preserve parent mtime, permission denied\n");
+            break;
+        case EROFS:
+            fprintf(stderr, "Warning: cannot preserve parent mtime, filesystem is read-only\n");
+            break;
+        default:
+            perror("Warning: futimens");
+            break;
+        }
+    }
+    close(fd);
+}
+
+const Vfs VFS_NATIVE = {
+    .name = "native",
+#if defined(__linux__) && !defined(__APPLE__)
+    .extent_clone_ids = true,
+#endif
+    .walk_open = native_walk_open,
+    .walk_next = native_walk_next,
+    .walk_skip = native_walk_skip,
+    .walk_close = native_walk_close,
+    .open = native_open,
+    .pread = native_pread,
+    .map = native_map,
+    .unmap = native_unmap,
+    .close = native_close,
+    .advise = native_advise,
+    .access = access,
+    .stat = native_stat,
+    .clone_id = native_clone_id,
+    .private_size = native_private_size,
+    .ext_flags = native_ext_flags,
+    .fragments = native_fragments,
+    .clone_supported = native_clone_supported,
+    .rotational = native_rotational,
+    .physical_offset = native_physical_offset,
+    .realpath = native_realpath,
+    .clone = native_clone,
+    .copy_contiguous = native_copy_contiguous,
+    .copy_metadata = native_copy_metadata,
+    .rename = rename,
+    .unlink = unlink,
+    .link = link,
+    .symlink = symlink,
+    .parent_mtime = native_parent_mtime,
+    .restore_parent_mtime = native_restore_parent_mtime,
+};
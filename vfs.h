@@ -0,0 +1,208 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_VFS_H__
+#define __DEDUP_VFS_H__
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#if defined(__linux__)
+#include <linux/fiemap.h>
+#endif
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#if !defined(__linux__)
+// the FS_IOC_FIEMAP extent flags, so extent maps can be simulated
+#define FIEMAP_EXTENT_LAST 0x00000001
+#define FIEMAP_EXTENT_UNKNOWN 0x00000002
+#define FIEMAP_EXTENT_DELALLOC 0x00000004
+#define FIEMAP_EXTENT_ENCODED 0x00000008
+#define FIEMAP_EXTENT_DATA_ENCRYPTED 0x00000080
+#define FIEMAP_EXTENT_NOT_ALIGNED 0x00000100
+#define FIEMAP_EXTENT_DATA_INLINE 0x00000200
+#define FIEMAP_EXTENT_DATA_TAIL 0x00000400
+#define FIEMAP_EXTENT_UNWRITTEN 0x00000800
+#define FIEMAP_EXTENT_MERGED 0x00001000
+#define FIEMAP_EXTENT_SHARED 0x00002000
+#endif
+
+/// VFS
+///
+/// Every filesystem operation `dedup` performs goes through the `Vfs`
+/// pointed to by `vfs`. By default that is `VFS_NATIVE`, which calls through
+/// to `fts(3)`, `open(2)`, `mmap(2)`, `getattrlist(2)`, `clonefile(2)`,
+/// `copyfile(3)`, and friends.
+///
+/// The memory backend (see `vfs_memory`) describes files by a size and a
+/// content seed instead of storing bytes, so trees of any size can be
+/// scanned and deduplicated deterministically without touching a disk.
+///
+/// Operations return the same values and set `errno` the same way as the
+/// system calls they stand in for.
+
+typedef struct VfsWalk VfsWalk;
+
+/// An entry returned by a walk. `info` is one of the `fts(3)` `FTS_*`
+/// values and `error` is the `fts_errno` of the entry.
+typedef struct VfsEntry {
+    char* path;
+    int info;
+    int error;
+    short level;
+    dev_t device;
+    ino_t inode;
+    nlink_t nlink;
+    uint32_t flags;
+    off_t size;
+} VfsEntry;
+
+typedef struct Vfs {
+    const char* name;
+    /// Set if clone ids are derived from the physical extents of a file, so
+    /// files with the same clone id are known to have the same content.
+    bool extent_clone_ids;
+
+    // traversal
+    VfsWalk* (*walk_open)(char* const* paths, int fts_options);
+    /// Returns false when the walk is complete.
+    bool (*walk_next)(VfsWalk* walk, VfsEntry* entry);
+    /// Skips the descendants of the entry last returned by `walk_next`.
+    void (*walk_skip)(VfsWalk* walk);
+    void (*walk_close)(VfsWalk* walk);
+
+    // reading
+    int (*open)(const char* path);
+    ssize_t (*pread)(int fd, void* buffer, size_t size, off_t offset);
+    /// Maps `size` bytes of `fd` for reading. Returns `NULL` on failure.
+    void* (*map)(int fd, size_t size);
+    void (*unmap)(void* buffer, size_t size);
+    void (*close)(int fd);
+    /// Optional. Starts reading `size` bytes of `fd` at `offset` into the
+    /// cache without waiting for them, so several reads can be outstanding
+    /// while the caller works on data it already has. Only a hint: failures
+    /// are ignored.
+    void (*advise)(int fd, off_t offset, size_t size);
+    /// Optional. Backends that know the SHA-256 of a file without reading
+    /// it return it here instead of it being computed from `map`.
+    int (*digest)(int fd, size_t size, uint8_t sha256[32]);
+
+    // metadata
+    int (*access)(const char* path, int mode);
+    int (*stat)(const char* path, struct stat* st);
+    int (*clone_id)(const char* path, uint64_t* clone_id);
+    int (*private_size)(const char* path, off_t* size);
+    int (*ext_flags)(const char* path, uint64_t* flags);
+    /// Sets `fragments` to the number of physically contiguous runs the
+    /// data of `path` is stored in. 0 if it is not stored in any.
+    int (*fragments)(const char* path, size_t* fragments);
+    bool (*clone_supported)(const char* path);
+    /// Returns true if `path` is on a disk that has to seek, where reading
+    /// files out of physical order is slow. False if it cannot be known.
+    bool (*rotational)(const char* path);
+    /// Sets `offset` to where the data of `path` starts on its device. Fails
+    /// if the file has no data or its location cannot be known.
+    int (*physical_offset)(const char* path, uint64_t* offset);
+    /// Returns a canonical path for `path` which must be freed by the
+    /// caller, or `NULL`.
+    char* (*realpath)(const char* path);
+
+    // modification
+    int (*clone)(const char* src, const char* dst);
+    /// Creates `dst` with a copy of the data of `src` written to space that
+    /// is allocated up front, as contiguously as the filesystem allows. The
+    /// access and modification times of `src` are kept.
+    int (*copy_contiguous)(const char* src, const char* dst);
+    /// Copies mode, flags, ACLs, and extended attributes from `src` to `dst`.
+    /// If `check` is set nothing is copied and the `copyfile(3)`
+    /// `COPYFILE_CHECK` result is returned instead.
+    int (*copy_metadata)(const char* src, const char* dst, bool check);
+    int (*rename)(const char* src, const char* dst);
+    int (*unlink)(const char* path);
+    int (*link)(const char* src, const char* dst);
+    int (*symlink)(const char* target, const char* path);
+
+    /// Saves the mtime of the directory containing `path`. On success the
+    /// caller must pass `handle` to `restore_parent_mtime`.
+    int (*parent_mtime)(const char* path, int* handle, struct timespec* mtime);
+    void (*restore_parent_mtime)(int handle, struct timespec mtime);
+} Vfs;
+
+extern const Vfs VFS_NATIVE;
+
+/// An extent of a file as reported by `FS_IOC_FIEMAP`. `flags` are
+/// `FIEMAP_EXTENT_*` flags.
+typedef struct VfsExtent {
+    uint64_t logical;
+    uint64_t physical;
+    uint64_t length;
+    uint32_t flags;
+} VfsExtent;
+
+/// Returns the identity a file on `device` of `size` bytes starts from
+/// before its extents are added with `extent_identity_add`.
+uint64_t extent_identity_start(dev_t device, off_t size);
+
+/// Adds `extent` to `identity`. Returns false if where `extent` is stored
+/// does not identify its data, in which case no identity derived from it
+/// may be taken to mean two files have the same content.
+bool extent_identity_add(uint64_t* identity, const VfsExtent* extent);
+
+/// The backend used for all filesystem access. Must only be changed before
+/// any other threads are started.
+extern const Vfs* vfs;
+
+/// Configures and returns the memory backend, or returns `NULL` if `spec` is
+/// invalid. `spec` is a comma separated list of `key=value` pairs:
+///
+///   files=n          number of files (required)
+///   seed=n           content seed. Default: 1
+///   size=min[:max]   file size range in bytes. Default: 4096:65536
+///   dup=percent      files duplicating an earlier file. Default: 25
+///   clones=percent   duplicates that are already clones. Default: 0
+///   latency=us       added to every operation. Default: 0
+///   throughput=mb    MB/s at which files are "read". Default: none
+///   rotational=0|1   whether the tree is on a disk that seeks. Default: 0
+///   devices=n        number of devices files are spread over. Default: 1
+///   unmapped=percent files whose clone id cannot be read. Default: 0
+///   extents=0|1      clone ids are derived from extents. Default: 1
+///   encoded=percent  files stored in slices of compressed extents which
+///                    start where other files do. Default: 0
+///   log=file         each file opened is logged to `file`
+///
+/// Files are named `<root>/d<n>/f<index>` for each walked `<root>`. Content,
+/// sizes, and clone ids are derived from the index and seed, so nothing is
+/// stored per file until it is replaced.
+const Vfs* vfs_memory(const char* spec);
+
+/// Loads a recording written with `record_open` and returns a read-only
+/// backend which replays it, or returns `NULL` and sets `errno` if it cannot
+/// be read. Walking any path returns the recorded entries, and probes,
+/// digests, and clone ids return the recorded results.
+const Vfs* vfs_replay(const char* path);
+
+#endif // __DEDUP_VFS_H__
@@ -0,0 +1,777 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <sys/rbtree.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fts.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vfs.h"
+
+// files are spread over this many directories under the root
+#define MEMORY_DIRECTORIES 1024
+#define MEMORY_DEVICE 0x4d454d
+#define MEMORY_BLOCK_SIZE 4096
+
+typedef struct MemoryConfig {
+    uint64_t files;
+    uint64_t seed;
+    uint64_t min_size;
+    uint64_t max_size;
+    unsigned duplicates;
+    unsigned clones;
+    uint64_t latency_us;
+    double throughput;
+    bool rotational;
+    uint64_t devices;
+    unsigned unmapped;
+    bool extents;
+    unsigned encoded;
+    FILE* log;
+} MemoryConfig;
+
+/// A file that has been changed since the tree was generated. Replacing a
+/// file gives it the content (origin) and clone id of another file. Staged
+/// files are the temporary names used by `replace_with_clone`. Contiguous
+/// files were written by `copy_contiguous` and are stored in one fragment.
+typedef struct MemoryOverride {
+    rb_node_t node;
+    uint64_t index;
+    uint64_t origin;
+    uint64_t clone_id;
+    bool contiguous;
+    bool removed;
+} MemoryOverride;
+
+struct VfsWalk {
+    char path[PATH_MAX];
+    const char* root;
+    uint64_t next;
+    bool started;
+    bool skipped;
+};
+
+static MemoryConfig config = { 0 };
+static pthread_mutex_t overrides_mutex = PTHREAD_MUTEX_INITIALIZER;
+static rb_tree_t overrides;
+static rb_tree_t staged;
+static atomic_bool modified = false;
+
+static signed int compare_override_node(void* context, const void* node1, const void* node2) {
+    const MemoryOverride* a = node1, * b = node2;
+    return a->index < b->index ? -1 : a->index > b->index;
+}
+
+static signed int compare_override_key(void* context, const void* node, const void* key) {
+    const MemoryOverride* a = node;
+    const uint64_t* index = key;
+    return a->index < *index ? -1 : a->index > *index;
+}
+
+static const rb_tree_ops_t OVERRIDE_OPS = {
+    .rbto_compare_nodes = compare_override_node,
+    .rbto_compare_key = compare_override_key,
+    .rbto_node_offset = offsetof(MemoryOverride, node),
+    .rbto_context = NULL,
+};
+
+static uint64_t mix(uint64_t z) {
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t file_hash(uint64_t index, uint64_t salt) {
+    return mix(config.seed ^ mix(index * 0x100000001b3ULL + salt));
+}
+
+static void delay(double us) {
+    if (us <= 0) {
+        return;
+    }
+    struct timespec t = {
+        .tv_sec = us / 1000000,
+        .tv_nsec = (long) (us * 1000) % 1000000000L,
+    };
+    nanosleep(&t, NULL);
+}
+
+// the original file whose content `index` was generated with, following
+// duplicates back to the first file with that content.
+static uint64_t generated_origin(uint64_t index) {
+    while (index && file_hash(index, 1) % 100 < config.duplicates) {
+        index = file_hash(index, 2) % index;
+    }
+    return index;
+}
+
+static uint64_t generated_clone_id(uint64_t index) {
+    uint64_t origin = generated_origin(index);
+    if (origin != index && file_hash(index, 3) % 100 < config.clones) {
+        return origin + 1;
+    }
+    return index + 1;
+}
+
+static uint64_t origin_size(uint64_t origin) {
+    return config.min_size + file_hash(origin, 4) % (config.max_size - config.min_size + 1);
+}
+
+static uint64_t allocated_size(uint64_t size) {
+    return (size + MEMORY_BLOCK_SIZE - 1) / MEMORY_BLOCK_SIZE * MEMORY_BLOCK_SIZE;
+}
+
+// returns the override for `index` in `tree`, or NULL. the overrides mutex
+// must be held.
+static MemoryOverride* find_override(rb_tree_t* tree, uint64_t index) {
+    return rb_tree_find_node(tree, &index);
+}
+
+static MemoryOverride* upsert_override(rb_tree_t* tree, uint64_t index) {
+    MemoryOverride* o = find_override(tree, index);
+    if (!o) {
+        o = calloc(1, sizeof(MemoryOverride));
+        o->index = index;
+        rb_tree_insert_node(tree, o);
+    }
+    atomic_store(&modified, true);
+    return o;
+}
+
+typedef struct MemoryFile {
+    uint64_t origin;
+    uint64_t clone_id;
+    bool contiguous;
+    bool exists;
+} MemoryFile;
+
+static MemoryFile lookup(uint64_t index, bool is_staged) {
+    MemoryFile f = {
+        .origin = generated_origin(index),
+        .clone_id = generated_clone_id(index),
+        .exists = !is_staged,
+    };
+
+    if (!atomic_load(&modified)) {
+        return f;
+    }
+
+    pthread_mutex_lock(&overrides_mutex);
+    MemoryOverride* o = find_override(is_staged ? &staged : &overrides, index);
+    if (o) {
+        f.origin = o->origin;
+        f.clone_id = o->clone_id;
+        f.contiguous = o->contiguous;
+        f.exists = !o->removed;
+    }
+    pthread_mutex_unlock(&overrides_mutex);
+    return f;
+}
+
+// returns the index of the file named by `path`, or -1 if `path` does not
+// name a file. `is_staged` is set if `path` is a staging name.
+static int64_t path_index(const char* path, bool* is_staged) {
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+
+    *is_staged = strncmp(name, ".~.", 3) == 0;
+    if (*is_staged) {
+        name += 3;
+    }
+
+    if (name[0] != 'f' || name[1] < '0' || name[1] > '9') {
+        return -1;
+    }
+
+    char* end = NULL;
+    uint64_t index = strtoull(name + 1, &end, 10);
+    if (*end || index >= config.files) {
+        return -1;
+    }
+    return index;
+}
+
+// like `path_index`, but sets errno and fails unless the file exists
+static int64_t existing_index(const char* path, bool* is_staged, MemoryFile* out) {
+    int64_t index = path_index(path, is_staged);
+    if (index < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    *out = lookup(index, *is_staged);
+    if (!out->exists) {
+        errno = ENOENT;
+        return -1;
+    }
+    return index;
+}
+
+// files are spread over `config.devices` devices by index
+static dev_t file_device(uint64_t index) {
+    return MEMORY_DEVICE + index % config.devices;
+}
+
+static VfsWalk* memory_walk_open(char* const* paths, int fts_options) {
+    VfsWalk* walk = calloc(1, sizeof(VfsWalk));
+    walk->root = paths[0];
+    return walk;
+}
+
+static bool memory_walk_next(VfsWalk* walk, VfsEntry* entry) {
+    delay(config.latency_us);
+
+    *entry = (VfsEntry) {
+        .path = walk->path,
+        .device = MEMORY_DEVICE,
+        .nlink = 1,
+    };
+
+    if (!walk->started) {
+        walk->started = true;
+        snprintf(walk->path, sizeof(walk->path), "%s", walk->root);
+        entry->info = FTS_D;
+        return true;
+    }
+
+    if (walk->skipped || walk->next >= config.files) {
+        return false;
+    }
+
+    uint64_t index = walk->next++;
+    snprintf(walk->path,
+             sizeof(walk->path),
+             "%s/d%llu/f%llu",
+             walk->root,
+             (unsigned long long) (index % MEMORY_DIRECTORIES),
+             (unsigned long long) index);
+    entry->info = FTS_F;
+    entry->level = 2;
+    entry->device = file_device(index);
+    entry->inode = index + 1;
+    entry->size = origin_size(lookup(index, false).origin);
+    return true;
+}
+
+static void memory_walk_skip(VfsWalk* walk) {
+    // only the root can be skipped, files have no descendants
+    if (walk->next == 0) {
+        walk->skipped = true;
+    }
+}
+
+static void memory_walk_close(VfsWalk* walk) {
+    free(walk);
+}
+
+// file descriptors are the index of the file
+// contiguous copies are written somewhere new
+static uint64_t stored_offset(const MemoryFile* f) {
+    return file_hash(f->clone_id - 1, f->contiguous ? 8 : 7);
+}
+
+static int memory_open(const char* path) {
+    delay(config.latency_us);
+
+    bool is_staged = false;
+    MemoryFile f;
+    int64_t index = existing_index(path, &is_staged, &f);
+    if (index < 0 || is_staged) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (config.log) {
+        fprintf(config.log, "%llu %llu %llu %s\n",
+                (unsigned long long) (uintptr_t) pthread_self(),
+                (unsigned long long) file_device(index),
+                (unsigned long long) stored_offset(&f), path);
+    }
+    return index;
+}
+
+// content is generated 8 bytes (one hash) at a time
+static void fill(uint64_t origin, void* buffer, size_t size, off_t offset) {
+    uint8_t* out = buffer;
+    for (size_t i = 0; i < size;) {
+        uint64_t position = offset + i;
+        uint64_t block = file_hash(origin ^ (position / 8) << 32, 5);
+        size_t skip = position % 8,
+               n = size - i < 8 - skip ? size - i : 8 - skip;
+        if (n == 8) {
+            memcpy(out + i, &block, 8);
+        } else {
+            for (size_t j = 0; j < n; j++) {
+                out[i + j] = block >> (8 * (skip + j));
+            }
+        }
+        i += n;
+    }
+}
+
+static ssize_t memory_pread(int fd, void* buffer, size_t size, off_t offset) {
+    delay(config.latency_us);
+
+    MemoryFile f = lookup(fd, false);
+    uint64_t file_size = origin_size(f.origin);
+    if ((uint64_t) offset >= file_size) {
+        return 0;
+    }
+    if (offset + size > file_size) {
+        size = file_size - offset;
+    }
+    fill(f.origin, buffer, size, offset);
+
+    if (config.throughput > 0) {
+        delay(size / config.throughput);
+    }
+    return size;
+}
+
+static void* memory_map(int fd, size_t size) {
+    delay(config.latency_us);
+
+    MemoryFile f = lookup(fd, false);
+    uint8_t* buffer = malloc(size ?: 1);
+    if (!buffer) {
+        return NULL;
+    }
+
+    fill(f.origin, buffer, size, 0);
+
+    if (config.throughput > 0) {
+        delay(size / config.throughput);
+    }
+    return buffer;
+}
+
+static void memory_unmap(void* buffer, size_t size) {
+    free(buffer);
+}
+
+static void memory_close(int fd) {
+}
+
+static int memory_access(const char* path, int mode) {
+    delay(config.latency_us);
+
+    bool is_staged = false;
+    if (path_index(path, &is_staged) < 0) {
+        // anything that isn't a file is a directory
+        return 0;
+    }
+
+    MemoryFile f;
+    return existing_index(path, &is_staged, &f) < 0 ? -1 : 0;
+}
+
+static int memory_stat(const char* path, struct stat* st) {
+    delay(config.latency_us);
+
+    bool is_staged = false;
+    MemoryFile f;
+    int64_t index = existing_index(path, &is_staged, &f);
+    if (index < 0) {
+        return -1;
+    }
+
+    *st = (struct stat) {
+        .st_dev = file_device(index),
+        .st_ino = index + 1,
+        .st_mode = S_IFREG | 0644,
+        .st_nlink = 1,
+        .st_size = origin_size(f.origin),
+        .st_blocks = allocated_size(origin_size(f.origin)) / 512,
+    };
+    return 0;
+}
+
+static int memory_clone_id(const char* path, uint64_t* clone_id) {
+    delay(config.latency_us);
+
+    bool is_staged = false;
+    MemoryFile f;
+    int64_t index = existing_index(path, &is_staged, &f);
+    if (index < 0) {
+        return -1;
+    }
+    // models files whose extents cannot be mapped
+    if (file_hash(index, 9) % 100 < config.unmapped) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (!config.extents) {
+        *clone_id = f.clone_id;
+        return 0;
+    }
+
+    // files are stored in one extent, except that encoded files are all
+    // slices of one compressed extent, and are located where it starts
+    uint64_t stored = f.clone_id - 1;
+    VfsExtent extent = {
+        .physical = stored_offset(&f),
+        .length = allocated_size(origin_size(f.origin)),
+        .flags = FIEMAP_EXTENT_LAST,
+    };
+    if (!f.contiguous && file_hash(stored, 10) % 100 < config.encoded) {
+        extent.physical = file_hash(file_device(stored), 11);
+        extent.flags |= FIEMAP_EXTENT_ENCODED;
+    }
+    // as with the native backend, files whose extents do not identify their
+    // data have an unknown clone id
+    uint64_t identity = extent_identity_start(file_device(index), origin_size(f.origin));
+    *clone_id = extent_identity_add(&identity, &extent) ? identity : 0;
+    return 0;
+}
+
+static int memory_private_size(const char* path, off_t* size) {
+    delay(config.latency_us);
+
+    bool is_staged = false;
+    MemoryFile f;
+    int64_t index = existing_index(path, &is_staged, &f);
+    if (index < 0) {
+        return -1;
+    }
+    // clones share all of their blocks with the file they were cloned from
+    *size = f.clone_id == (uint64_t) index + 1 ? allocated_size(origin_size(f.origin)) : 0;
+    return 0;
+}
+
+static int memory_fragments(const char* path, size_t* fragments) {
+    delay(config.latency_us);
+
+    bool is_staged = false;
+    MemoryFile f;
+    int64_t index = existing_index(path, &is_staged, &f);
+    if (index < 0) {
+        return -1;
+    }
+    // clones are stored wherever the file they were cloned from is
+    uint64_t stored = f.clone_id - 1;
+    *fragments = f.contiguous ? 1 : 1 + file_hash(stored, 6) % 16;
+    return 0;
+}
+
+static int memory_physical_offset(const char* path, uint64_t* offset) {
+    delay(config.latency_us);
+
+    bool is_staged = false;
+    MemoryFile f;
+    int64_t index = existing_index(path, &is_staged, &f);
+    if (index < 0) {
+        return -1;
+    }
+    *offset = stored_offset(&f);
+    return 0;
+}
+
+static int memory_ext_flags(const char* path, uint64_t* flags) {
+    *flags = 0;
+    return 0;
+}
+
+static bool memory_clone_supported(const char* path) {
+    return true;
+}
+
+static bool memory_rotational(const char* path) {
+    return config.rotational;
+}
+
+static char* memory_realpath(const char* path) {
+    return strdup(path);
+}
+
+// gives `dst` the content and clone id of `src`, optionally as a staged file
+static int replace(const char* src, const char* dst, bool to_staged, bool share_clone_id) {
+    delay(config.latency_us);
+
+    bool is_staged = false;
+    MemoryFile f;
+    if (existing_index(src, &is_staged, &f) < 0) {
+        return -1;
+    }
+
+    bool dst_staged = false;
+    int64_t index = path_index(dst, &dst_staged);
+    if (index < 0 || dst_staged != to_staged) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    MemoryFile d = lookup(index, dst_staged);
+    if (d.exists) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    pthread_mutex_lock(&overrides_mutex);
+    MemoryOverride* o = upsert_override(dst_staged ? &staged : &overrides, index);
+    o->origin = f.origin;
+    o->clone_id = share_clone_id ? f.clone_id : (uint64_t) index + 1;
+    o->contiguous = share_clone_id ? f.contiguous : true;
+    o->removed = false;
+    pthread_mutex_unlock(&overrides_mutex);
+    return 0;
+}
+
+static int memory_clone(const char* src, const char* dst) {
+    return replace(src, dst, true, true);
+}
+
+// a copy owns its blocks, which are allocated in one run
+static int memory_copy_contiguous(const char* src, const char* dst) {
+    return replace(src, dst, true, false);
+}
+
+static int memory_copy_metadata(const char* src, const char* dst, bool check) {
+    delay(config.latency_us);
+    return 0;
+}
+
+static int memory_rename(const char* src, const char* dst) {
+    delay(config.latency_us);
+
+    bool src_staged = false, dst_staged = false;
+    int64_t from = path_index(src, &src_staged),
+            to = path_index(dst, &dst_staged);
+    if (from < 0 || to < 0 || !src_staged || dst_staged) {
+        // only staged files are ever renamed
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&overrides_mutex);
+    MemoryOverride* s = find_override(&staged, from);
+    if (!s || s->removed) {
+        pthread_mutex_unlock(&overrides_mutex);
+        errno = ENOENT;
+        return -1;
+    }
+    rb_tree_remove_node(&staged, s);
+
+    MemoryOverride* o = upsert_override(&overrides, to);
+    o->origin = s->origin;
+    o->clone_id = s->clone_id;
+    o->contiguous = s->contiguous;
+    o->removed = false;
+    pthread_mutex_unlock(&overrides_mutex);
+
+    free(s);
+    return 0;
+}
+
+static int memory_unlink(const char* path) {
+    delay(config.latency_us);
+
+    bool is_staged = false;
+    MemoryFile f;
+    int64_t index = existing_index(path, &is_staged, &f);
+    if (index < 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&overrides_mutex);
+    MemoryOverride* o = upsert_override(is_staged ? &staged : &overrides, index);
+    o->origin = f.origin;
+    o->clone_id = f.clone_id;
+    o->contiguous = f.contiguous;
+    o->removed = true;
+    pthread_mutex_unlock(&overrides_mutex);
+    return 0;
+}
+
+static int memory_link(const char* src, const char* dst) {
+    return replace(src, dst, false, true);
+}
+
+// a symlink is modeled as a file with the same content as its target
+static int memory_symlink(const char* target, const char* path) {
+    bool is_staged = false;
+    int64_t index = path_index(path, &is_staged);
+    if (index < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // `target` is relative to the directory containing `path`
+    char resolved[PATH_MAX] = { 0 };
+    const char* slash = strrchr(path, '/');
+    snprintf(resolved,
+             sizeof(resolved),
+             "%.*s%s",
+             slash ? (int) (slash - path + 1) : 0,
+             path,
+             target);
+    return replace(resolved, path, false, false);
+}
+
+static int memory_parent_mtime(const char* path, int* handle, struct timespec* mtime) {
+    *handle = -1;
+    *mtime = (struct timespec) { 0 };
+    return 0;
+}
+
+static void memory_restore_parent_mtime(int handle, struct timespec mtime) {
+}
+
+static Vfs VFS_MEMORY = {
+    .name = "memory",
+    // files only share a clone id with files they were cloned from
+    .extent_clone_ids = true,
+    .walk_open = memory_walk_open,
+    .walk_next = memory_walk_next,
+    .walk_skip = memory_walk_skip,
+    .walk_close = memory_walk_close,
+    .open = memory_open,
+    .pread = memory_pread,
+    .map = memory_map,
+    .unmap = memory_unmap,
+    .close = memory_close,
+    .access = memory_access,
+    .stat = memory_stat,
+    .clone_id = memory_clone_id,
+    .private_size = memory_private_size,
+    .ext_flags = memory_ext_flags,
+    .fragments = memory_fragments,
+    .clone_supported = memory_clone_supported,
+    .rotational = memory_rotational,
+    .physical_offset = memory_physical_offset,
+    .realpath = memory_realpath,
+    .clone = memory_clone,
+    .copy_contiguous = memory_copy_contiguous,
+    .copy_metadata = memory_copy_metadata,
+    .rename = memory_rename,
+    .unlink = memory_unlink,
+    .link = memory_link,
+    .symlink = memory_symlink,
+    .parent_mtime = memory_parent_mtime,
+    .restore_parent_mtime = memory_restore_parent_mtime,
+};
+
+static bool parse_uint(const char* s, uint64_t* out) {
+    char* end = NULL;
+    errno = 0;
+    *out = strtoull(s, &end, 10);
+    return !errno && end != s && (*end == '\0' || *end == ',' || *end == ':');
+}
+
+const Vfs* vfs_memory(const char* spec) {
+    config = (MemoryConfig) {
+        .seed = 1,
+        .min_size = 4096,
+        .max_size = 65536,
+        .duplicates = 25,
+        .devices = 1,
+        .extents = true,
+    };
+
+    char* copy = strdup(spec);
+    char* rest = copy;
+    char* pair = NULL;
+    bool valid = true;
+    while (valid && (pair = strsep(&rest, ","))) {
+        char* value = strchr(pair, '=');
+        if (!value) {
+            valid = false;
+            break;
+        }
+        *value++ = '\0';
+
+        uint64_t n = 0;
+        if (strcmp(pair, "files") == 0) {
+            valid = parse_uint(value, &config.files) && config.files <= INT_MAX;
+        } else if (strcmp(pair, "seed") == 0) {
+            valid = parse_uint(value, &config.seed);
+        } else if (strcmp(pair, "size") == 0) {
+            char* max = strchr(value, ':');
+            valid = parse_uint(value, &config.min_size);
+            config.max_size = config.min_size;
+            if (valid && max) {
+                valid = parse_uint(max + 1, &config.max_size);
+            }
+            valid = valid && config.min_size <= config.max_size;
+        } else if (strcmp(pair, "dup") == 0) {
+            valid = parse_uint(value, &n) && n <= 100;
+            config.duplicates = n;
+        } else if (strcmp(pair, "clones") == 0) {
+            valid = parse_uint(value, &n) && n <= 100;
+            config.clones = n;
+        } else if (strcmp(pair, "latency") == 0) {
+            valid = parse_uint(value, &config.latency_us);
+        } else if (strcmp(pair, "devices") == 0) {
+            valid = parse_uint(value, &config.devices) && config.devices > 0;
+        } else if (strcmp(pair, "rotational") == 0) {
+            valid = parse_uint(value, &n) && n <= 1;
+            config.rotational = n;
+        } else if (strcmp(pair, "extents") == 0) {
+            valid = parse_uint(value, &n) && n <= 1;
+            config.extents = n;
+        } else if (strcmp(pair, "unmapped") == 0) {
+            valid = parse_uint(value, &n) && n <= 100;
+            config.unmapped = n;
+        } else if (strcmp(pair, "encoded") == 0) {
+            valid = parse_uint(value, &n) && n <= 100;
+            config.encoded = n;
+        } else if (strcmp(pair, "log") == 0) {
+            if (config.log) {
+                fclose(config.log);
+            }
+            config.log = fopen(value, "w");
+            valid = config.log != NULL;
+        } else if (strcmp(pair, "throughput") == 0) {
+            valid = parse_uint(value, &n) && n > 0;
+            // MB/s is bytes per microsecond
+            config.throughput = n;
+        } else {
+            valid = false;
+        }
+    }
+    free(copy);
+
+    if (!valid || config.files == 0) {
+        if (config.log) {
+            fclose(config.log);
+        }
+        return NULL;
+    }
+
+    rb_tree_init(&overrides, &OVERRIDE_OPS);
+    rb_tree_init(&staged, &OVERRIDE_OPS);
+    VFS_MEMORY.extent_clone_ids = config.extents;
+    return &VFS_MEMORY;
+}
@@ -0,0 +1,481 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <sys/rbtree.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fts.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "record.h"
+#include "vfs.h"
+
+/// A recorded file, shared by every entry with the same device and inode.
+typedef struct ReplayFile {
+    rb_node_t node;
+    dev_t device;
+    ino_t inode;
+    uint64_t clone_id;
+    size_t allocated_size;
+    size_t private_size;
+    char first;
+    char last;
+    bool probed;
+    bool digested;
+    uint8_t sha256[32];
+    bool measured;
+    size_t fragments;
+} ReplayFile;
+
+typedef struct ReplayEntry {
+    rb_node_t node;
+    char* path;
+    ReplayFile* file;
+    nlink_t nlink;
+    uint32_t flags;
+    off_t size;
+    short level;
+} ReplayEntry;
+
+struct VfsWalk {
+    size_t next;
+};
+
+static ReplayEntry* entries = NULL;
+static size_t entry_count = 0;
+static rb_tree_t files;
+static rb_tree_t paths;
+
+static signed int compare_file_node(void* context, const void* node1, const void* node2) {
+    const ReplayFile* a = node1, * b = node2;
+    if (a->device != b->device) {
+        return a->device < b->device ? -1 : 1;
+    }
+    return a->inode < b->inode ? -1 : a->inode > b->inode;
+}
+
+static signed int compare_file_key(void* context, const void* node, const void* key) {
+    return compare_file_node(context, node, key);
+}
+
+static const rb_tree_ops_t FILE_OPS = {
+    .rbto_compare_nodes = compare_file_node,
+    .rbto_compare_key = compare_file_key,
+    .rbto_node_offset = offsetof(ReplayFile, node),
+    .rbto_context = NULL,
+};
+
+static signed int compare_path_node(void* context, const void* node1, const void* node2) {
+    const ReplayEntry* a = node1, * b = node2;
+    return strcmp(a->path, b->path);
+}
+
+static signed int compare_path_key(void* context, const void* node, const void* key) {
+    const ReplayEntry* a = node;
+    return strcmp(a->path, key);
+}
+
+static const rb_tree_ops_t PATH_OPS = {
+    .rbto_compare_nodes = compare_path_node,
+    .rbto_compare_key = compare_path_key,
+    .rbto_node_offset = offsetof(ReplayEntry, node),
+    .rbto_context = NULL,
+};
+
+static ReplayFile* find_file(uint64_t device, uint64_t inode, bool create) {
+    ReplayFile key = { .device = device, .inode = inode };
+    ReplayFile* f = rb_tree_find_node(&files, &key);
+    if (!f && create) {
+        f = calloc(1, sizeof(ReplayFile));
+        f->device = device;
+        f->inode = inode;
+        rb_tree_insert_node(&files, f);
+    }
+    return f;
+}
+
+static ReplayEntry* find_entry(const char* path) {
+    ReplayEntry* e = rb_tree_find_node(&paths, path);
+    if (!e) {
+        errno = ENOENT;
+    }
+    return e;
+}
+
+static VfsWalk* replay_walk_open(char* const* walk_paths, int fts_options) {
+    return calloc(1, sizeof(VfsWalk));
+}
+
+static bool replay_walk_next(VfsWalk* walk, VfsEntry* entry) {
+    if (walk->next >= entry_count) {
+        return false;
+    }
+
+    ReplayEntry* e = &entries[walk->next++];
+    *entry = (VfsEntry) {
+        .path = e->path,
+        .info = FTS_F,
+        .level = e->level,
+        .device = e->file->device,
+        .inode = e->file->inode,
+        .nlink = e->nlink,
+        .flags = e->flags,
+        .size = e->size,
+    };
+    return true;
+}
+
+static void replay_walk_skip(VfsWalk* walk) {
+}
+
+static void replay_walk_close(VfsWalk* walk) {
+    free(walk);
+}
+
+// file descriptors are the index of the entry
+static int replay_open(const char* path) {
+    ReplayEntry* e = find_entry(path);
+    return e ? e - entries : -1;
+}
+
+// only the bytes recorded by the probe can be read
+static ssize_t replay_pread(int fd, void* buffer, size_t size, off_t offset) {
+    ReplayEntry* e = &entries[fd];
+    if (!e->file->probed || size != 1 || (offset != 0 && offset != e->size - 1)) {
+        errno = EIO;
+        return -1;
+    }
+    *(char*) buffer = offset ? e->file->last : e->file->first;
+    return 1;
+}
+
+static void* replay_map(int fd, size_t size) {
+    errno = ENOTSUP;
+    return NULL;
+}
+
+static void replay_unmap(void* buffer, size_t size) {
+}
+
+static void replay_close(int fd) {
+}
+
+static int replay_digest(int fd, size_t size, uint8_t sha256[32]) {
+    ReplayFile* f = entries[fd].file;
+    if (!f->digested) {
+        errno = EIO;
+        return -1;
+    }
+    memcpy(sha256, f->sha256, sizeof(f->sha256));
+    return 0;
+}
+
+// starting paths and directories are not recorded, so every path is
+// accepted
+static int replay_access(const char* path, int mode) {
+    return 0;
+}
+
+static int replay_stat(const char* path, struct stat* st) {
+    ReplayEntry* e = find_entry(path);
+    if (!e) {
+        return -1;
+    }
+
+    *st = (struct stat) {
+        .st_dev = e->file->device,
+        .st_ino = e->file->inode,
+        .st_mode = S_IFREG | 0644,
+        .st_nlink = e->nlink,
+        .st_size = e->size,
+        .st_blocks = e->file->probed
+            ? (off_t) (e->file->allocated_size / 512)
+            : (e->size + 511) / 512,
+    };
+    return 0;
+}
+
+static int replay_clone_id(const char* path, uint64_t* clone_id) {
+    ReplayEntry* e = find_entry(path);
+    if (!e) {
+        return -1;
+    }
+    *clone_id = e->file->clone_id;
+    return 0;
+}
+
+static int replay_private_size(const char* path, off_t* size) {
+    ReplayEntry* e = find_entry(path);
+    if (!e) {
+        return -1;
+    }
+    *size = e->file->probed ? (off_t) e->file->private_size : e->size;
+    return 0;
+}
+
+static int replay_ext_flags(const char* path, uint64_t* flags) {
+    *flags = 0;
+    return 0;
+}
+
+static int replay_fragments(const char* path, size_t* fragments) {
+    ReplayEntry* e = find_entry(path);
+    if (!e) {
+        return -1;
+    }
+    // files that were not origin candidates were never measured
+    *fragments = e->file->measured ? e->file->fragments : 1;
+    return 0;
+}
+
+static bool replay_clone_supported(const char* path) {
+    return true;
+}
+
+// files are evaluated the same in any order, so the order they were read in
+// is not recorded
+static bool replay_rotational(const char* path) {
+    return false;
+}
+
+static int replay_physical_offset(const char* path, uint64_t* offset) {
+    errno = ENOTSUP;
+    return -1;
+}
+
+static char* replay_realpath(const char* path) {
+    return strdup(path);
+}
+
+// recordings are read-only
+static int replay_read_only() {
+    errno = EROFS;
+    return -1;
+}
+
+static int replay_clone(const char* src, const char* dst) {
+    return replay_read_only();
+}
+
+static int replay_copy_contiguous(const char* src, const char* dst) {
+    return replay_read_only();
+}
+
+static int replay_copy_metadata(const char* src, const char* dst, bool check) {
+    return replay_read_only();
+}
+
+static int replay_rename(const char* src, const char* dst) {
+    return replay_read_only();
+}
+
+static int replay_unlink(const char* path) {
+    return replay_read_only();
+}
+
+static int replay_parent_mtime(const char* path, int* handle, struct timespec* mtime) {
+    return replay_read_only();
+}
+
+static void replay_restore_parent_mtime(int handle, struct timespec mtime) {
+}
+
+static Vfs VFS_REPLAY = {
+    .name = "replay",
+    .walk_open = replay_walk_open,
+    .walk_next = replay_walk_next,
+    .walk_skip = replay_walk_skip,
+    .walk_close = replay_walk_close,
+    .open = replay_open,
+    .pread = replay_pread,
+    .map = replay_map,
+    .unmap = replay_unmap,
+    .close = replay_close,
+    .digest = replay_digest,
+    .access = replay_access,
+    .stat = replay_stat,
+    .clone_id = replay_clone_id,
+    .private_size = replay_private_size,
+    .ext_flags = replay_ext_flags,
+    .fragments = replay_fragments,
+    .clone_supported = replay_clone_supported,
+    .rotational = replay_rotational,
+    .physical_offset = replay_physical_offset,
+    .realpath = replay_realpath,
+    .clone = replay_clone,
+    .copy_contiguous = replay_copy_contiguous,
+    .copy_metadata = replay_copy_metadata,
+    .rename = replay_rename,
+    .unlink = replay_unlink,
+    .link = replay_clone,
+    .symlink = replay_clone,
+    .parent_mtime = replay_parent_mtime,
+    .restore_parent_mtime = replay_restore_parent_mtime,
+};
+
+// reads the next `size` bytes of a recording into `out`
+static bool take(const char** cursor, const char* end, void* out, size_t size) {
+    if ((size_t) (end - *cursor) < size) {
+        return false;
+    }
+    memcpy(out, *cursor, size);
+    *cursor += size;
+    return true;
+}
+
+static char* read_file(const char* path, size_t* size) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return NULL;
+    }
+
+    size_t capacity = 1 << 20, length = 0;
+    char* data = malloc(capacity);
+    size_t n = 0;
+    while ((n = fread(data + length, 1, capacity - length, f)) > 0) {
+        length += n;
+        if (length == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+
+    if (ferror(f)) {
+        int saved = errno;
+        fclose(f);
+        free(data);
+        errno = saved;
+        return NULL;
+    }
+    fclose(f);
+
+    *size = length;
+    return data;
+}
+
+const Vfs* vfs_replay(const char* path) {
+    size_t size = 0;
+    char* data = read_file(path, &size);
+    if (!data) {
+        return NULL;
+    }
+
+    rb_tree_init(&files, &FILE_OPS);
+    rb_tree_init(&paths, &PATH_OPS);
+
+    const char* cursor = data, * end = data + size;
+    RecordHeader header;
+    bool valid = take(&cursor, end, &header, sizeof(header)) &&
+        memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == RECORD_VERSION;
+
+    size_t capacity = 0;
+    char type = 0;
+    while (valid && take(&cursor, end, &type, 1)) {
+        switch (type) {
+        case RECORD_ENTRY: {
+            RecordEntry r;
+            char* entry_path = NULL;
+            valid = take(&cursor, end, &r, sizeof(r)) &&
+                (entry_path = calloc(r.path_length + 1, 1)) &&
+                take(&cursor, end, entry_path, r.path_length);
+            if (!valid) {
+                free(entry_path);
+                break;
+            }
+
+            if (entry_count == capacity) {
+                capacity = capacity ? capacity * 2 : 1024;
+                entries = realloc(entries, capacity * sizeof(ReplayEntry));
+            }
+            entries[entry_count++] = (ReplayEntry) {
+                .path = entry_path,
+                .file = find_file(r.device, r.inode, true),
+                .nlink = r.nlink,
+                .flags = r.flags,
+                .size = r.size,
+                .level = r.level,
+            };
+            break;
+        }
+        case RECORD_PROBE: {
+            RecordProbe r;
+            valid = take(&cursor, end, &r, sizeof(r));
+            ReplayFile* f = valid ? find_file(r.device, r.inode, true) : NULL;
+            if (f) {
+                f->first = r.first;
+                f->last = r.last;
+                f->clone_id = r.clone_id;
+                f->allocated_size = r.allocated_size;
+                f->private_size = r.private_size;
+                f->probed = true;
+            }
+            break;
+        }
+        case RECORD_DIGEST: {
+            RecordDigest r;
+            valid = take(&cursor, end, &r, sizeof(r));
+            ReplayFile* f = valid ? find_file(r.device, r.inode, true) : NULL;
+            if (f) {
+                memcpy(f->sha256, r.sha256, sizeof(f->sha256));
+                f->digested = true;
+            }
+            break;
+        }
+        case RECORD_FRAGMENTS: {
+            RecordFragments r;
+            valid = take(&cursor, end, &r, sizeof(r));
+            ReplayFile* f = valid ? find_file(r.device, r.inode, true) : NULL;
+            if (f) {
+                f->fragments = r.fragments;
+                f->measured = true;
+            }
+            break;
+        }
+        default:
+            valid = false;
+        }
+    }
+    free(data);
+
+    VFS_REPLAY.extent_clone_ids = valid && (header.flags & RECORD_EXTENT_CLONE_IDS);
+
+    if (!valid) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // the entries no longer move, so they can be indexed by path
+    for (size_t i = 0; i < entry_count; i++) {
+        rb_tree_insert_node(&paths, &entries[i]);
+    }
+
+    return &VFS_REPLAY;
+}